@@ -1,4 +1,5 @@
 #include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
 
 #define SIZE 3
 #define BATCH 4
@@ -8,9 +9,8 @@ typedef double TYPE;
 inline Value_Vec<TYPE> read_dataset(const char *intput_file);
 inline std::vector<Value_Vec<TYPE>> forward(MLP<TYPE, 3> &model,
                                             Value_Vec<TYPE> &inputs);
-Value<TYPE> back_prop(const std::vector<Value_Vec<TYPE>> &scores,
-                      const Value_Vec<TYPE> &target,
-                      const std::vector<Value<TYPE> *> parameters);
+TYPE back_prop(const std::vector<Value_Vec<TYPE>> &scores,
+               const Value_Vec<TYPE> &target);
 
 // Main function
 int main(int argc, char *argv[]) {
@@ -28,24 +28,29 @@ int main(int argc, char *argv[]) {
     std::cout << model << '\n';
     std::cout << "number of parameters: " << model.parameters().size() << "\n";
 
+    // No regularization, as in the original loss. The L2 term alpha * sum(p^2)
+    // would be SGD(model.parameters(), 1.0, 2.0 * alpha) as weight decay
+    auto optimizer = SGD<TYPE>(model.parameters(), 1.0);
+
     const size_t epochs = 100;
     for (size_t epoch = 0; epoch < epochs; ++epoch) {
+#ifdef MICROGRAD_DEBUG_GRAPH
+        // The same at every epoch: nothing outlives the scope of the step
+        std::cout << " live values: " << live_values() << '\n';
+#endif
+        GraphScope<TYPE> scope;
         model.zero_grad();
 
         auto scores = forward(model, inputs);
 
-        auto total_loss = back_prop(scores, target, model.parameters());
+        auto total_loss = back_prop(scores, target);
 
         // Weights update
         double learning_rate = 1.0 - (0.9 * epoch) / 100;
-        learning_rate = std::max(learning_rate, 0.001);
-
-        for (Value<TYPE> *p : model.parameters()) {
-            p->data -= learning_rate * p->grad;
-        }
+        optimizer.learning_rate = std::max(learning_rate, 0.001);
+        optimizer.step();
 
-        std::cout << " epoch: " << epoch << " loss: " << total_loss.data
-                  << '\n';
+        std::cout << " epoch: " << epoch << " loss: " << total_loss << '\n';
     }
 }
 
@@ -79,50 +84,22 @@ inline std::vector<Value_Vec<TYPE>> forward(MLP<TYPE, 3> &model,
     return scores;
 }
 
-Value<TYPE> back_prop(const std::vector<Value_Vec<TYPE>> &scores,
-                      const Value_Vec<TYPE> &target,
-                      const std::vector<Value<TYPE> *> parameters) {
-    // Need to divide it in multiple step to hold the keep the computation
-    Value_Vec<TYPE> tmp1;
-    for (size_t i = 0; i < target.size(); i++) {
-        tmp1.emplace_back(target[i] * scores[i][0]);
-    }
-
-    Value_Vec<TYPE> tmp2;
-    for (size_t i = 0; i < target.size(); i++) {
-        tmp2.emplace_back((1.0 - tmp1[i]));
-    }
-
-    Value_Vec<TYPE> losses;
-    for (size_t i = 0; i < target.size(); i++) {
-        losses.emplace_back(tmp2[i].relu());
-    }
-
-    // svm "max-margin" loss
-    auto sum_losses = Value<TYPE>(0.0);
-    for (auto &loss : losses) {
-        sum_losses += loss;
-    }
-
-    auto square_sum = Value<TYPE>(0.0);
-
-    // auto alpha = Value<TYPE>(0.0001);
-
-    // L2 regularization
-    for (Value<TYPE> *p : parameters) {
-        square_sum += (*p ^ 2.0);
+TYPE back_prop(const std::vector<Value_Vec<TYPE>> &scores,
+               const Value_Vec<TYPE> &target) {
+    // The network has a single output
+    Value_Vec<TYPE> outputs;
+    for (auto &score : scores) {
+        outputs.emplace_back(score[0]);
     }
-    /*  */
-    // auto data_loss = sum_losses * (1.0 / losses.size());
-    /*  */
-    /* auto reg_loss = alpha * square_sum; */
-    /*  */
-    /* auto total_loss = data_loss + reg_loss; */
 
-    auto total_loss = data_loss;
+    // svm "max-margin" loss as a single fused node
+    auto total_loss = hinge_loss(outputs, target);
 
     // Back Prop
     total_loss.backward();
+#ifdef MICROGRAD_DEBUG_GRAPH
+    check_graph(total_loss);
+#endif
 
     double accuracy = 0.0;
     for (size_t i = 0; i < target.size(); ++i) {
@@ -131,5 +108,6 @@ Value<TYPE> back_prop(const std::vector<Value_Vec<TYPE>> &scores,
     accuracy = accuracy / target.size();
     std::cout << " The accuracy is: " << accuracy * 100 << " %";
 
-    return total_loss;
+    // Only the data: the graph does not outlive outputs
+    return total_loss.data;
 }
@@ -0,0 +1,209 @@
+#include <micrograd/expr.hpp>
+#include <functional>
+
+typedef double TYPE;
+
+using namespace value_engine;
+
+// Gradients of the backward kernels against central finite differences for
+// every op, one small graph each
+
+// Builds its graph on the leaves x, runs backward from the root and returns
+// the data of the root. The graph lives in the function so the leaves are
+// the only values it leaves behind
+using Graph = std::function<TYPE(Value_Vec<TYPE> &)>;
+
+struct Case {
+    const char *name;
+    Graph f;
+    std::vector<TYPE> point;
+};
+
+TYPE root(Value<TYPE> &y) {
+    y.backward();
+    return y.data;
+}
+
+// Largest error relative to max(1, |numeric|) over the leaves
+TYPE gradient_error(const Case &c) {
+    Value_Vec<TYPE> x(c.point.begin(), c.point.end());
+    c.f(x);
+
+    const TYPE h = 1e-6;
+    TYPE max_error = 0.0;
+    for (size_t i = 0; i < x.size(); i++) {
+        Value_Vec<TYPE> plus(c.point.begin(), c.point.end());
+        Value_Vec<TYPE> minus(c.point.begin(), c.point.end());
+        plus[i].data += h;
+        minus[i].data -= h;
+        const TYPE numeric = (c.f(plus) - c.f(minus)) / (2.0 * h);
+        max_error =
+            std::max(max_error, std::abs(numeric - x[i].grad) /
+                                    std::max(TYPE(1.0), std::abs(numeric)));
+    }
+    return max_error;
+}
+
+int main() {
+    const std::vector<Case> cases = {
+        {"add", [](auto &x) { auto y = x[0] + x[1]; return root(y); },
+         {0.3, -1.2}},
+        {"dif", [](auto &x) { auto y = x[0] - x[1]; return root(y); },
+         {0.3, -1.2}},
+        {"mul", [](auto &x) { auto y = x[0] * x[1]; return root(y); },
+         {0.3, -1.2}},
+        {"div", [](auto &x) { auto y = x[0] / x[1]; return root(y); },
+         {0.3, -1.2}},
+        // The exponent is a constant, only the base gets a gradient
+        {"pow",
+         [](auto &x) {
+             auto b = Value<TYPE>(2.5);
+             auto y = x[0] ^ b;
+             return root(y);
+         },
+         {1.3}},
+        {"inv",
+         [](auto &x) {
+             auto y = x[0].inverse_value();
+             return root(y);
+         },
+         {-0.7}},
+        {"exp", [](auto &x) { auto y = x[0].exp_value(); return root(y); },
+         {0.4}},
+        {"tanh", [](auto &x) { auto y = x[0].tanh(); return root(y); },
+         {0.4}},
+        {"relu +", [](auto &x) { auto y = x[0].relu(); return root(y); },
+         {0.7}},
+        {"relu -", [](auto &x) { auto y = x[0].relu(); return root(y); },
+         {-0.4}},
+        {"lrelu +", [](auto &x) { auto y = x[0].lrelu(); return root(y); },
+         {0.7}},
+        {"lrelu -", [](auto &x) { auto y = x[0].lrelu(); return root(y); },
+         {-0.4}},
+        {"swish +", [](auto &x) { auto y = x[0].swish(); return root(y); },
+         {0.7}},
+        {"swish -", [](auto &x) { auto y = x[0].swish(); return root(y); },
+         {-1.3}},
+        {"sum", [](auto &x) { auto y = sum(x); return root(y); },
+         {0.3, -1.2, 2.0}},
+        {"mean", [](auto &x) { auto y = mean(x); return root(y); },
+         {0.3, -1.2, 2.0}},
+        {"dot",
+         [](auto &x) {
+             Value_Vec<TYPE> lhs = {x[0], x[1]}, rhs = {x[2], x[3]};
+             auto y = dot(lhs, rhs);
+             root(y);
+             // The copies got the gradients
+             for (size_t i = 0; i < 2; i++) {
+                 x[i].grad = lhs[i].grad;
+                 x[2 + i].grad = rhs[i].grad;
+             }
+             return y.data;
+         },
+         {0.3, -1.2, 2.0, 0.5}},
+        {"max", [](auto &x) { auto y = max(x); return root(y); },
+         {0.3, -1.2, 2.0}},
+        {"log_sum_exp",
+         [](auto &x) {
+             auto y = log_sum_exp(x);
+             return root(y);
+         },
+         {0.3, -1.2, 2.0}},
+        {"softmax",
+         [](auto &x) {
+             auto s = softmax(x);
+             auto sx = s[0] * x[1];
+             auto y = sx + s[2];
+             return root(y);
+         },
+         {0.3, -1.2, 2.0}},
+        {"cross_entropy",
+         [](auto &x) { auto y = cross_entropy(x, 1); return root(y); },
+         {0.3, -1.2, 2.0}},
+        {"hinge_loss",
+         [](auto &x) {
+             Value_Vec<TYPE> scores = {x[0], x[1]}, targets = {1.0, -1.0};
+             auto y = hinge_loss(scores, targets);
+             root(y);
+             x[0].grad = scores[0].grad;
+             x[1].grad = scores[1].grad;
+             return y.data;
+         },
+         {0.3, -0.2}},
+        {"mse_loss",
+         [](auto &x) {
+             Value_Vec<TYPE> y_pred = {x[0], x[1]}, targets = {1.0, -1.0};
+             auto y = mse_loss(y_pred, targets);
+             root(y);
+             x[0].grad = y_pred[0].grad;
+             x[1].grad = y_pred[1].grad;
+             return y.data;
+         },
+         {0.3, -0.2}},
+        {"bce_loss",
+         [](auto &x) {
+             Value_Vec<TYPE> logits = {x[0], x[1]}, targets = {1.0, 0.0};
+             auto y = bce_loss(logits, targets);
+             root(y);
+             x[0].grad = logits[0].grad;
+             x[1].grad = logits[1].grad;
+             return y.data;
+         },
+         {0.3, -0.2}},
+        {"cross_entropy_loss",
+         [](auto &x) {
+             std::vector<Value_Vec<TYPE>> logits = {x};
+             auto y = cross_entropy_loss<TYPE>(logits, {2});
+             root(y);
+             for (size_t i = 0; i < x.size(); i++) {
+                 x[i].grad = logits[0][i].grad;
+             }
+             return y.data;
+         },
+         {0.3, -1.2, 2.0}},
+        {"fused",
+         [](auto &x) {
+             auto y = expr::fuse(
+                 [](auto a, auto b) { return a * b + exp_value(a) / b; }, x[0],
+                 x[1]);
+             return root(y);
+         },
+         {0.3, -1.2}},
+        // Shared values on different levels of the schedule
+        {"graph",
+         [](auto &x) {
+             auto ab = x[0] * x[1];
+             auto t = ab.tanh();
+             auto s = t.swish();
+             auto ta = t * x[0];
+             auto ab_s = ab + s;
+             auto y = ab_s - ta;
+             return root(y);
+         },
+         {0.3, -1.2}},
+    };
+
+    bool passed = true;
+    for (auto &c : cases) {
+        const TYPE error = gradient_error(c);
+        std::cout << c.name << ": " << error << '\n';
+        if (!(error < 1e-6)) {
+            std::cout << "wrong gradient of " << c.name << '\n';
+            passed = false;
+        }
+    }
+
+    // backward after draw_graph, which sorts the graph without scheduling it
+    auto a = Value<TYPE>(2.0, "a"), b = Value<TYPE>(3.0, "b");
+    auto c = a * b;
+    c.draw_graph();
+    c.backward();
+    std::cout << "draw_graph then backward: " << a.grad << " " << b.grad
+              << '\n';
+    if (a.grad != 3.0 || b.grad != 2.0) {
+        passed = false;
+    }
+
+    std::cout << (passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+#include "moons.hpp"
+#include <micrograd/hogwild.hpp>
+
+#define SIZE 3
+#define THREADS 4
+typedef double TYPE;
+
+// Convergence of the Hogwild trainer against the synchronous training of
+// demo.cpp on the moons dataset, with the same model and the same seed
+
+double accuracy(MLP<TYPE, SIZE> &model,
+                const std::vector<Value_Vec<TYPE>> &samples,
+                const Value_Vec<TYPE> &target) {
+    GraphScope<TYPE> scope;
+    double accuracy = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        auto score = model(samples[i]);
+        accuracy += (score[0].data > 0) == (target[i].data > 0);
+    }
+    model.zero_grad();
+    return accuracy / samples.size();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: hogwild_test X.txt y.txt\n";
+        return -1;
+    }
+
+    std::vector<TYPE> inputs = read_dataset<TYPE>(argv[1]);
+    std::vector<TYPE> labels = read_dataset<TYPE>(argv[2]);
+
+    const auto samples = to_value_samples(to_samples(inputs));
+    const Value_Vec<TYPE> target(labels.begin(), labels.end());
+
+    const size_t epochs = 100;
+
+    // Synchronous full batch training as in demo.cpp
+    auto model = MLP<TYPE, SIZE>(2, {16, 16, 1});
+    train(model, samples, target, epochs);
+    const double sync_accuracy = accuracy(model, samples, target);
+
+    // Hogwild training, one update per sample on THREADS threads and no
+    // weight decay either
+    auto shared_model = MLP<TYPE, SIZE>(2, {16, 16, 1});
+    auto trainer = HogwildTrainer<TYPE, SIZE>(shared_model, THREADS);
+    const TYPE loss = trainer.train(
+        samples, target, epochs,
+        [](size_t epoch) {
+            return std::max(0.05 * (1.0 - (0.9 * epoch) / 100), 0.001);
+        },
+        hinge_loss<TYPE>);
+    const double hogwild_accuracy = accuracy(shared_model, samples, target);
+
+    std::cout << "synchronous accuracy: " << sync_accuracy * 100 << " %\n";
+    std::cout << "hogwild accuracy: " << hogwild_accuracy * 100
+              << " % loss: " << loss << '\n';
+
+    // Hogwild may lose some updates but has to reach the same result
+    if (hogwild_accuracy + 0.05 < sync_accuracy) {
+        std::cout << "FAILED\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    return 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
+
+// Dataset and training loop of demo.cpp shared by the tests that compare
+// another way of training or running the model against it
+
+template <typename T> std::vector<T> read_dataset(const char *intput_file) {
+    std::vector<T> data;
+    std::ifstream file(intput_file);
+    if (!file.is_open()) {
+        std::cout << "failed to open: " << intput_file << " file\n";
+        return {};
+    }
+
+    double x;
+    while (file >> x) {
+        data.push_back(x);
+    }
+    return data;
+}
+
+// View the inputs as (x/2, 2)
+template <typename T>
+std::vector<std::vector<T>> to_samples(const std::vector<T> &inputs) {
+    std::vector<std::vector<T>> samples;
+    for (size_t i = 0; i + 1 < inputs.size(); i += 2) {
+        samples.push_back({inputs[i], inputs[i + 1]});
+    }
+    return samples;
+}
+
+template <typename T>
+std::vector<Value_Vec<T>>
+to_value_samples(const std::vector<std::vector<T>> &samples) {
+    std::vector<Value_Vec<T>> value_samples;
+    for (auto &sample : samples) {
+        value_samples.emplace_back(sample.begin(), sample.end());
+    }
+    return value_samples;
+}
+
+// Synchronous full batch training with the hinge loss, the optimizer and the
+// learning rate schedule of demo.cpp
+template <typename T, size_t N>
+void train(MLP<T, N> &model, const std::vector<Value_Vec<T>> &samples,
+           const Value_Vec<T> &target, size_t epochs) {
+    auto optimizer = SGD<T>(model.parameters(), 1.0);
+    for (size_t epoch = 0; epoch < epochs; ++epoch) {
+        GraphScope<T> scope;
+        model.zero_grad();
+
+        Value_Vec<T> outputs;
+        for (auto &sample : samples) {
+            outputs.emplace_back(model(sample)[0]);
+        }
+        auto loss = hinge_loss(outputs, target);
+        loss.backward();
+
+        optimizer.learning_rate = std::max(1.0 - (0.9 * epoch) / 100, 0.001);
+        optimizer.step();
+    }
+}
@@ -0,0 +1,97 @@
+#include "moons.hpp"
+#include <micrograd/quantize.hpp>
+#include <chrono>
+
+#define SIZE 3
+typedef double TYPE;
+
+// Accuracy of the int8 model against the float model it comes from, trained
+// as in demo.cpp on the moons dataset
+
+double accuracy(const std::vector<std::vector<TYPE>> &scores,
+                const std::vector<TYPE> &target) {
+    double accuracy = 0.0;
+    for (size_t i = 0; i < scores.size(); i++) {
+        accuracy += (scores[i][0] > 0) == (target[i] > 0);
+    }
+    return accuracy / scores.size();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: quantize_test X.txt y.txt\n";
+        return -1;
+    }
+
+    std::vector<TYPE> inputs = read_dataset<TYPE>(argv[1]);
+    std::vector<TYPE> target = read_dataset<TYPE>(argv[2]);
+
+    const auto samples = to_samples(inputs);
+    const Value_Vec<TYPE> value_target(target.begin(), target.end());
+
+    const size_t epochs = 100;
+
+    auto model = MLP<TYPE, SIZE>(2, {16, 16, 1});
+    train(model, to_value_samples(samples), value_target, epochs);
+
+    const auto quantized = QuantizedMLP<TYPE, SIZE>(model);
+
+    const auto float_scores = model.predict(samples);
+    const auto int8_scores = quantized.predict(samples);
+    std::vector<std::vector<TYPE>> fallback_scores;
+    for (auto &sample : samples) {
+        fallback_scores.push_back(quantized.predict_float(sample));
+    }
+
+    double max_error = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) {
+        max_error = std::max(max_error,
+                             std::abs(float_scores[i][0] - int8_scores[i][0]));
+    }
+
+    // Time of a single sample through both models
+    const size_t repeats = 2000;
+    auto time = [&](auto &&predict) {
+        const auto start = std::chrono::steady_clock::now();
+        TYPE total = 0.0;
+        for (size_t r = 0; r < repeats; r++) {
+            for (auto &sample : samples) {
+                total += predict(sample)[0];
+            }
+        }
+        const std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+        // Keep the results alive
+        if (total == 0.123) {
+            std::cout << total;
+        }
+        return elapsed.count() / (repeats * samples.size());
+    };
+    const double float_time =
+        time([&](const std::vector<TYPE> &x) { return model.predict(x); });
+    const double int8_time =
+        time([&](const std::vector<TYPE> &x) { return quantized.predict(x); });
+
+    const double float_accuracy = accuracy(float_scores, target);
+    const double int8_accuracy = accuracy(int8_scores, target);
+    const double fallback_accuracy = accuracy(fallback_scores, target);
+    const size_t float_bytes = model.parameters().size() * sizeof(TYPE);
+
+    std::cout << "float accuracy: " << float_accuracy * 100 << " % "
+              << float_bytes << " bytes " << float_time << " ns/sample\n";
+    std::cout << "int8 accuracy: " << int8_accuracy * 100 << " % "
+              << quantized.size_bytes() << " bytes " << int8_time
+              << " ns/sample\n";
+    std::cout << "int8 weights with float activations accuracy: "
+              << fallback_accuracy * 100 << " %\n";
+    std::cout << "max score error: " << max_error << '\n';
+
+    // At most one more sample wrong out of the 100 of the dataset
+    if (int8_accuracy + 0.01 < float_accuracy ||
+        fallback_accuracy + 0.01 < float_accuracy) {
+        std::cout << "FAILED\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <micrograd/serve.hpp>
+#include <algorithm>
+
+#define SIZE 3
+#define CLIENTS 8
+#define REQUESTS 2000
+typedef double TYPE;
+
+// In process harness for the inference server: CLIENTS threads send single
+// sample requests to the same model, the outputs are checked against the
+// sequential predictions and the latency percentiles are reported
+
+int main() {
+    auto model = MLP<TYPE, SIZE>(2, {16, 16, 1});
+
+    // Inputs on the moons range
+    Random rng(42);
+    std::vector<std::vector<TYPE>> inputs(REQUESTS);
+    for (auto &x : inputs) {
+        x = {rng.uniform(-1.5, 2.5), rng.uniform(-1.0, 1.5)};
+    }
+
+    // Reference outputs computed sequentially
+    std::vector<std::vector<TYPE>> expected;
+    for (auto &x : inputs) {
+        expected.push_back(model.predict(x));
+    }
+
+    std::vector<double> latencies(CLIENTS * REQUESTS);
+    size_t errors = 0;
+    std::mutex errors_mutex;
+    {
+        InferenceServer<TYPE, SIZE> server(model, 4, 32,
+                                           std::chrono::microseconds(200));
+
+        std::vector<std::thread> clients;
+        for (size_t c = 0; c < CLIENTS; c++) {
+            clients.emplace_back([&, c]() {
+                for (size_t i = 0; i < REQUESTS; i++) {
+                    const auto start = std::chrono::steady_clock::now();
+                    auto output = server.predict(inputs[i]);
+                    const auto end = std::chrono::steady_clock::now();
+
+                    latencies[c * REQUESTS + i] =
+                        std::chrono::duration<double, std::micro>(end - start)
+                            .count();
+                    if (output != expected[i]) {
+                        std::lock_guard<std::mutex> lock(errors_mutex);
+                        errors++;
+                    }
+                }
+            });
+        }
+        for (auto &client : clients) {
+            client.join();
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "requests: " << latencies.size() << '\n';
+    std::cout << "latency p50: " << latencies[latencies.size() / 2]
+              << " us p99: " << latencies[latencies.size() * 99 / 100]
+              << " us max: " << latencies.back() << " us\n";
+
+    if (errors != 0) {
+        std::cout << errors << " wrong outputs\nFAILED\n";
+        return 1;
+    }
+    std::cout << "PASSED\n";
+    return 0;
+}
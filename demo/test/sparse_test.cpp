@@ -0,0 +1,119 @@
+#include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
+
+#define SIZE 2
+#define FEATURES 50
+#define WORDS 4
+typedef double TYPE;
+
+// Sparse inputs over several epochs, each step and each evaluation in a
+// GraphScope of its own as in sparse_example.cpp. The evaluation does not
+// zero the model, so the next step runs after the scope of the outputs the
+// model still points to has ended. A model with the same weights trains on
+// the equivalent dense inputs next to it: the outputs, the gradients of
+// every parameter and of the inputs and the updated weights have to match
+
+std::vector<TYPE> to_dense(const Sparse_Vec<TYPE> &x) {
+    std::vector<TYPE> dense(x.size, 0.0);
+    for (size_t k = 0; k < x.indices.size(); k++) {
+        dense[x.indices[k]] += x.values[k].data;
+    }
+    return dense;
+}
+
+int main() {
+    Random rng(7);
+    std::vector<Sparse_Vec<TYPE>> inputs(8);
+    Value_Vec<TYPE> targets;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i].size = FEATURES;
+        for (size_t k = 0; k < WORDS; k++) {
+            inputs[i].indices.push_back(rng.next() % FEATURES);
+            inputs[i].values.emplace_back(rng.uniform(TYPE(0.5), TYPE(2.0)));
+        }
+        targets.emplace_back(i % 2 == 0 ? 1.0 : -1.0);
+    }
+
+    std::vector<Value_Vec<TYPE>> dense_inputs;
+    for (auto &x : inputs) {
+        const auto dense = to_dense(x);
+        dense_inputs.emplace_back(dense.begin(), dense.end());
+    }
+
+    auto model = MLP<TYPE, SIZE>(FEATURES, {4, 1}, Random(3));
+    auto dense_model = MLP<TYPE, SIZE>(FEATURES, {4, 1}, Random(3));
+    auto optimizer = SGD<TYPE>(model.parameters(), 0.1);
+    auto dense_optimizer = SGD<TYPE>(dense_model.parameters(), 0.1);
+
+    bool passed = true;
+    auto check = [&passed](const char *what, TYPE sparse, TYPE dense) {
+        if (!(std::abs(sparse - dense) < 1e-12)) {
+            std::cout << "different " << what << ": " << sparse << " sparse "
+                      << dense << " dense\n";
+            passed = false;
+        }
+    };
+
+    for (size_t epoch = 0; epoch < 3; epoch++) {
+        {
+            GraphScope<TYPE> scope;
+            dense_model.zero_grad();
+            Value_Vec<TYPE> outputs, dense_outputs;
+            for (size_t i = 0; i < inputs.size(); i++) {
+                outputs.emplace_back(model(inputs[i])[0]);
+                dense_outputs.emplace_back(dense_model(dense_inputs[i])[0]);
+                check("output", outputs[i].data, dense_outputs[i].data);
+            }
+            auto loss = hinge_loss(outputs, targets);
+            auto dense_loss = hinge_loss(dense_outputs, targets);
+            loss.backward();
+            dense_loss.backward();
+
+            // The weights of the zero inputs get no gradient in both
+            auto params = model.parameters();
+            auto dense_params = dense_model.parameters();
+            for (size_t j = 0; j < params.size(); j++) {
+                check("gradient", params[j]->grad, dense_params[j]->grad);
+            }
+            // The zeros of the sparse input are constants, only its indices
+            // get a gradient. The repeated ones of the last input add up
+            const auto &x = inputs.back();
+            std::vector<TYPE> input_grad(FEATURES, 0.0);
+            for (size_t k = 0; k < x.indices.size(); k++) {
+                input_grad[x.indices[k]] += model.last_inputs()[k].grad;
+            }
+            for (size_t i : x.indices) {
+                check("input gradient", input_grad[i],
+                      dense_model.last_inputs()[i].grad);
+            }
+
+            optimizer.step(model.touched_parameters());
+            dense_optimizer.step();
+            model.zero_touched_grad();
+            for (size_t j = 0; j < params.size(); j++) {
+                check("weight", params[j]->data, dense_params[j]->data);
+            }
+            std::cout << " epoch: " << epoch << " loss: " << loss.data << '\n';
+        }
+
+        // The graph output against the inference path on the dense input
+        GraphScope<TYPE> scope;
+        for (auto &x : inputs) {
+            const TYPE score = model(x)[0].data;
+            const TYPE expected = model.predict(to_dense(x))[0];
+            if (!(std::abs(score - expected) < 1e-12)) {
+                std::cout << "wrong sparse output " << score << " instead of "
+                          << expected << '\n';
+                passed = false;
+            }
+            // Values of the last input, not the ones of a freed copy
+            auto &last = model.last_inputs();
+            for (size_t k = 0; k < last.size(); k++) {
+                passed = passed && last[k].data == x.values[k].data;
+            }
+        }
+    }
+
+    std::cout << (passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
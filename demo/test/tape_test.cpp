@@ -0,0 +1,153 @@
+#include <micrograd/tape.hpp>
+
+typedef double TYPE;
+
+using namespace value_engine;
+
+// What the Tape adds to the graph: the leaves moved with set() and the
+// values recomputed by forward(), several times on the same tape, the leaves
+// set and not recomputed yet, the jacobian between the two and the errors.
+// The recomputed values and gradients have to match the graph built directly
+// at the same point
+
+// Shared values on different levels of the tape, and an output which only
+// depends on b through the kink of relu
+struct Graph {
+    Value<TYPE> a, b, ab, t, s, ta, ab_s, y, r;
+
+    Graph(TYPE a_data, TYPE b_data)
+        : a(a_data), b(b_data), ab(a * b), t(ab.tanh()), s(t.swish()),
+          ta(t * a), ab_s(ab + s), y(ab_s - ta), r(b.relu()) {}
+    Graph(const Graph &) = delete;
+
+    std::vector<Value<TYPE> *> outputs() { return {&y, &r}; }
+};
+
+// Gradients of the leaves for one output of the graph built at (a, b)
+std::vector<TYPE> rebuilt_grads(TYPE a, TYPE b, size_t output) {
+    Graph g(a, b);
+    g.outputs()[output]->backward();
+    return {g.a.grad, g.b.grad};
+}
+
+bool near(TYPE lhs, TYPE rhs) { return std::abs(lhs - rhs) < 1e-12; }
+
+// set() and forward() on a sequence of points, only the leaves which move
+// are set: r is not recomputed for the points which only move a
+bool set_and_forward() {
+    const std::vector<std::pair<TYPE, TYPE>> points = {
+        {-0.8, 0.5}, {1.1, 0.5}, {1.1, -0.7}, {0.3, -0.7}};
+
+    bool passed = true;
+    Graph g(0.3, -1.2);
+    Tape<TYPE> tape(g.outputs());
+    TYPE a = 0.3, b = -1.2;
+    for (auto [next_a, next_b] : points) {
+        if (next_a != a) {
+            tape.set(g.a, next_a);
+            a = next_a;
+        }
+        if (next_b != b) {
+            tape.set(g.b, next_b);
+            b = next_b;
+        }
+        const size_t recomputed = tape.forward();
+
+        Graph expected(a, b);
+        std::cout << "point " << a << " " << b << ": recomputed " << recomputed
+                  << " of " << tape.size() << '\n';
+        passed = passed && near(g.y.data, expected.y.data) &&
+                 near(g.r.data, expected.r.data) && recomputed < tape.size();
+
+        for (size_t output = 0; output < 2; output++) {
+            tape.backward(output);
+            const auto grads = rebuilt_grads(a, b, output);
+            passed = passed && near(g.a.grad, grads[0]) &&
+                     near(g.b.grad, grads[1]);
+        }
+    }
+    return passed;
+}
+
+// The leaves set without a forward() keep the outputs as they were until the
+// next one, which recomputes them once
+bool set_without_forward() {
+    Graph g(0.3, -1.2);
+    Tape<TYPE> tape(g.outputs());
+    const TYPE y = g.y.data;
+
+    tape.set(g.a, -0.8);
+    tape.set(g.a, 1.1);
+    std::cout << "set without forward: " << g.a.data << " " << g.y.data
+              << '\n';
+    bool passed = g.a.data == 1.1 && g.y.data == y;
+
+    const size_t recomputed = tape.forward();
+    Graph expected(1.1, -1.2);
+    passed = passed && near(g.y.data, expected.y.data) &&
+             near(g.r.data, expected.r.data);
+    // Nothing is left dirty
+    passed = passed && recomputed > 0 && tape.forward() == 0;
+    return passed;
+}
+
+// The jacobian after set() and before forward() still sees the set leaf,
+// whose local derivatives only use the data of the leaves
+bool jacobian_after_set() {
+    auto a = Value<TYPE>(2.0), b = Value<TYPE>(3.0);
+    auto p = a * b;
+    auto q = a + b;
+    Tape<TYPE> tape({&p, &q});
+
+    tape.set(a, 5.0);
+    const auto jacobian = tape.jacobian({&a, &b});
+    std::cout << "jacobian after set: " << jacobian[0][0] << " "
+              << jacobian[0][1] << " | " << jacobian[1][0] << " "
+              << jacobian[1][1] << '\n';
+    bool passed = jacobian[0][0] == 3.0 && jacobian[0][1] == 5.0 &&
+                  jacobian[1][0] == 1.0 && jacobian[1][1] == 1.0;
+
+    // The leaf is still dirty for the next forward
+    tape.forward();
+    passed = passed && p.data == 15.0 && q.data == 8.0;
+    return passed;
+}
+
+template <typename E, typename F> bool throws(F f) {
+    try {
+        f();
+    } catch (const E &) {
+        return true;
+    }
+    return false;
+}
+
+// The values which are not leaves of the tape are rejected and left as they
+// are, and so are the seeds which do not match the outputs
+bool errors() {
+    auto a = Value<TYPE>(2.0), b = Value<TYPE>(3.0), other = Value<TYPE>(1.0);
+    auto c = a * b;
+    auto d = c + a;
+    Tape<TYPE> tape({&d});
+
+    bool passed = throws<std::out_of_range>([&] { tape.set(other, 5.0); });
+    passed = passed && other.data == 1.0;
+    passed = passed &&
+             throws<std::invalid_argument>([&] { tape.set(c, 5.0); });
+    passed = passed && c.data == 6.0;
+    passed = passed && throws<std::invalid_argument>(
+                           [&] { tape.backward(std::vector<TYPE>{1.0, 1.0}); });
+    passed = passed && throws<std::out_of_range>([&] { tape.backward(1); });
+    std::cout << "errors: " << (passed ? "thrown" : "missing") << '\n';
+    return passed;
+}
+
+int main() {
+    bool passed = set_and_forward();
+    passed = set_without_forward() && passed;
+    passed = jacobian_after_set() && passed;
+    passed = errors() && passed;
+
+    std::cout << (passed ? "PASSED\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
@@ -37,6 +37,7 @@ int main() {
     double lr = 0.005;
 
     for (size_t j = 1; j <= 1000; j++) {
+        GraphScope<TYPE> scope;
 
         std::vector<Value_Vec<TYPE>> ypred;
         Value_Vec<TYPE> tmp_loss;
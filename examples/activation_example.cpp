@@ -0,0 +1,66 @@
+#include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
+#include <chrono>
+
+#define SIZE 3
+typedef double TYPE;
+
+int main() {
+    // Points inside or outside of a circle
+    Random rng(3);
+    std::vector<Value_Vec<TYPE>> inputs;
+    std::vector<std::vector<TYPE>> samples;
+    Value_Vec<TYPE> targets;
+    for (size_t i = 0; i < 50; i++) {
+        const TYPE x = rng.uniform<TYPE>(-1.0, 1.0);
+        const TYPE y = rng.uniform<TYPE>(-1.0, 1.0);
+        inputs.push_back({Value<TYPE>(x), Value<TYPE>(y)});
+        samples.push_back({x, y});
+        targets.emplace_back(x * x + y * y < 0.5 ? 1.0 : -1.0);
+    }
+
+    const std::pair<activation, const char *> activations[] = {
+        {activation::relu, "relu"},
+        {activation::lrelu, "lrelu"},
+        {activation::tanh, "tanh"},
+        {activation::swish, "swish"},
+    };
+
+    // Same model and seed, only the activation of the hidden layers changes
+    for (auto &[act, name] : activations) {
+        auto model =
+            MLP<TYPE, SIZE>(2, {8, 8, 1}, {act, act, activation::linear});
+        auto optimizer = SGD<TYPE>(model.parameters(), 0.5, 0.0002);
+
+        TYPE last_loss = 0.0;
+        for (size_t epoch = 0; epoch < 50; epoch++) {
+            GraphScope<TYPE> scope;
+            model.zero_grad();
+            Value_Vec<TYPE> outputs;
+            for (auto &x : inputs) {
+                outputs.emplace_back(model(x)[0]);
+            }
+            auto loss = hinge_loss(outputs, targets);
+            loss.backward();
+            optimizer.step();
+            last_loss = loss.data;
+        }
+
+        // The activation is resolved once per layer in predict
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::vector<TYPE>> scores;
+        for (size_t r = 0; r < 100; r++) {
+            scores = model.predict(samples);
+        }
+        const std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        size_t correct = 0;
+        for (size_t i = 0; i < samples.size(); i++) {
+            correct += (scores[i][0] > 0.0) == (targets[i].data > 0.0);
+        }
+        std::cout << name << " loss: " << last_loss
+                  << " accuracy: " << 100.0 * correct / samples.size()
+                  << " % predict: " << elapsed.count() / 100 << " us\n";
+    }
+}
@@ -0,0 +1,44 @@
+#include <micrograd/data.hpp>
+#include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
+
+#define SIZE 3
+#define BATCH 10
+typedef double TYPE;
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cout << "Usage: data_loader_example X.txt y.txt\n";
+        return -1;
+    }
+
+    auto model = MLP<TYPE, SIZE>(2, {16, 16, 1});
+    std::cout << model << '\n';
+
+    auto optimizer = SGD<TYPE>(model.parameters(), 0.1, 0.0002);
+
+    // The next mini batches are read, shuffled and batched on a background
+    // thread while the current one trains
+    const size_t epochs = 50;
+    DataLoader<TYPE> loader(argv[1], argv[2], 2, BATCH, epochs, 32);
+
+    Batch<TYPE> batch;
+    size_t step = 0;
+    while (loader.next(batch)) {
+        GraphScope<TYPE> scope;
+        model.zero_grad();
+
+        Value_Vec<TYPE> outputs;
+        for (auto &x : batch.inputs) {
+            outputs.emplace_back(model(x)[0]);
+        }
+
+        auto loss = hinge_loss(outputs, batch.targets);
+        loss.backward();
+        optimizer.step();
+
+        if (++step % 50 == 0) {
+            std::cout << " step: " << step << " loss: " << loss.data << '\n';
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#include <micrograd/nn.hpp>
+
+#define N_OUTPUT_LAYERS 3
+
+int main() {
+    // Small network with few inputs and many outputs where forward mode is
+    // cheaper than a backward pass for each output
+    std::array<size_t, N_OUTPUT_LAYERS> output_layers_sizes = {8, 8, 4};
+    auto model = MLP<double, N_OUTPUT_LAYERS>(2, output_layers_sizes);
+
+    std::vector<double> x = {2.0, 3.0};
+
+    // Jacobian vector product along v in a single forward pass
+    std::array<std::vector<double>, 1> v = {{{1.0, -1.0}}};
+    auto y = jvp<1>([&](auto &inputs) { return model(inputs); }, x, v);
+
+    std::cout << "Outputs and JVP along v:" << '\n';
+    std::cout << "-----------------" << '\n';
+    for (auto &out : y) {
+        std::cout << out << '\n';
+    }
+
+    // Full (4, 2) Jacobian, both columns in the same forward pass
+    auto jacobian = jacobian_forward<2>(
+        [&](auto &inputs) { return model(inputs); }, x);
+
+    std::cout << "Jacobian:" << '\n';
+    std::cout << "-----------------" << '\n';
+    for (auto &row : jacobian) {
+        std::cout << row[0] << " " << row[1] << '\n';
+    }
+
+    // Check the first column with finite differences
+    std::vector<Dual<double, 1>> x_plus = {x[0] + 1e-6, x[1]};
+    std::vector<Dual<double, 1>> x_minus = {x[0] - 1e-6, x[1]};
+    auto y_plus = model(x_plus);
+    auto y_minus = model(x_minus);
+    std::cout << "Finite differences first column:";
+    for (size_t j = 0; j < y_plus.size(); j++) {
+        std::cout << " " << (y_plus[j].data - y_minus[j].data) / 2e-6;
+    }
+    std::cout << '\n';
+
+    return 0;
+}
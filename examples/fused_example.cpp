@@ -0,0 +1,44 @@
+#include <micrograd/expr.hpp>
+
+using namespace value_engine;
+
+int main() {
+    // Same perceptron as single_perceptron.cpp written as a single fused
+    // value instead of one value for every operator
+
+    // Input x1, x2
+    auto x1 = Value<double>(2.0, "x1"), x2 = Value<double>(0.0, "x2");
+    // Weight w1, w2
+    auto w1 = Value<double>(-3.0, "w1"), w2 = Value<double>(1.0, "w2");
+    // Bias of the neuron b
+    auto b = Value<double>(6.8813735870195432, "b");
+
+    // The whole expression is captured at compile time
+    auto o = expr::fuse(
+        [](auto x1, auto w1, auto x2, auto w2, auto b) {
+            auto n = x1 * w1 + x2 * w2 + b;
+            // Custom tanh implementation
+            auto e = exp_value(n * 2);
+            return (e - 1) / (e + 1);
+        },
+        x1, w1, x2, w2, b);
+    o.label = "o";
+
+    o.backward();
+
+    std::cout << o << '\n';
+    std::cout << x1 << '\n';
+    std::cout << w1 << '\n';
+    std::cout << x2 << '\n';
+    std::cout << w2 << '\n';
+    std::cout << b << '\n';
+
+    // Same expression built with the leaves directly
+    auto y1 = Value<double>(2.0, "y1"), y2 = Value<double>(-1.0, "y2");
+    auto mse = expr::fuse(((expr::leaf(y1) - 1.5) ^ 2.0) +
+                          ((expr::leaf(y2) + 0.5) ^ 2.0));
+    mse.backward();
+    std::cout << mse << '\n';
+    std::cout << y1 << '\n';
+    std::cout << y2 << '\n';
+}
@@ -0,0 +1,57 @@
+#include <micrograd/tape.hpp>
+
+using namespace value_engine;
+
+int main() {
+    // Same perceptron as single_perceptron.cpp, recorded once and then
+    // re-evaluated for many values of w1 without building it again
+    auto x1 = Value<double>(2.0, "x1"), x2 = Value<double>(0.0, "x2");
+    auto w1 = Value<double>(-3.0, "w1"), w2 = Value<double>(1.0, "w2");
+    auto b = Value<double>(6.8813735870195432, "b");
+
+    auto x1w1 = x1 * w1;
+    auto x2w2 = x2 * w2;
+    auto x1w1_x2w2 = x1w1 + x2w2;
+    auto n = x1w1_x2w2 + b;
+    auto o = n.tanh();
+
+    Tape<double> perceptron({&o});
+    std::cout << "w1 sweep:\n";
+    for (double w = -3.0; w <= -2.0; w += 0.25) {
+        perceptron.set(w1, w);
+        const size_t recomputed = perceptron.forward();
+        perceptron.backward(0);
+        std::cout << " w1: " << w << " o: " << o.data << " do/dw1: " << w1.grad
+                  << " recomputed " << recomputed << " of "
+                  << perceptron.size() << '\n';
+    }
+
+    // A wide graph: sum(tanh(x_i * w_i)), changing one input only touches
+    // its own branch and the sum
+    const size_t width = 1000;
+    Value_Vec<double> xs, ws, products, activations;
+    xs.reserve(width);
+    ws.reserve(width);
+    products.reserve(width);
+    activations.reserve(width);
+    for (size_t i = 0; i < width; i++) {
+        xs.emplace_back(0.001 * i);
+        ws.emplace_back(1.0);
+        products.emplace_back(xs[i] * ws[i]);
+        activations.emplace_back(products[i].tanh());
+    }
+    auto total = sum(activations);
+
+    Tape<double> wide({&total});
+    wide.set(xs[10], 3.0);
+    const size_t recomputed = wide.forward();
+
+    // Same result as building the graph again
+    double expected = 0.0;
+    for (size_t i = 0; i < width; i++) {
+        expected += std::tanh(xs[i].data * ws[i].data);
+    }
+    std::cout << "\nwide graph: " << total.data << " (rebuilt: " << expected
+              << ") recomputed " << recomputed << " of " << wide.size()
+              << '\n';
+}
@@ -0,0 +1,62 @@
+#include <micrograd/nn.hpp>
+#include <micrograd/tape.hpp>
+
+#define N_OUTPUT_LAYERS 3
+
+int main() {
+    // Jacobian of the outputs of a network with respect to its inputs
+    std::array<size_t, N_OUTPUT_LAYERS> output_layers_sizes = {8, 8, 4};
+    auto model = MLP<double, N_OUTPUT_LAYERS>(3, output_layers_sizes);
+
+    Value_Vec<double> x = {2.0, 3.0, -1.0};
+    Value_Vec<double> y = model(x);
+
+    // The graph is recorded once and swept once for all the outputs
+    auto tape = Tape<double>(y);
+    auto jacobian = tape.jacobian(model.last_inputs());
+
+    // Same Jacobian with the forward mode
+    auto jacobian_fwd = jacobian_forward<3>(
+        [&](auto &inputs) { return model(inputs); },
+        std::vector<double>{2.0, 3.0, -1.0});
+
+    std::cout << "Jacobian (reverse | forward):" << '\n';
+    std::cout << "-----------------" << '\n';
+    for (size_t i = 0; i < jacobian.size(); i++) {
+        for (size_t j = 0; j < jacobian[i].size(); j++) {
+            std::cout << jacobian[i][j] << " ";
+        }
+        std::cout << "| ";
+        for (size_t j = 0; j < jacobian_fwd[i].size(); j++) {
+            std::cout << jacobian_fwd[i][j] << " ";
+        }
+        std::cout << '\n';
+    }
+
+    // Full Hessian of f(a, b) = a^2 * b + e^(a * b) with two Hessian vector
+    // products computed in the same backward pass
+    using D = Dual<double, 2>;
+    auto a = Value<D>(0.5, "a"), b = Value<D>(-1.5, "b");
+    seed_tangents<double, 2>({&a, &b}, {{{1.0, 0.0}, {0.0, 1.0}}});
+
+    auto two = Value<D>(2.0);
+    auto a2 = a ^ two;
+    auto a2b = a2 * b;
+    auto ab = a * b;
+    auto e = ab.exp_value();
+    auto f = a2b + e;
+
+    auto hessian = hessian_vector_product<double, 2>(f, {&a, &b});
+
+    // Analytical Hessian
+    const double av = 0.5, bv = -1.5, ev = std::exp(av * bv);
+    std::cout << "Hessian (forward over reverse | analytical):" << '\n';
+    std::cout << "-----------------" << '\n';
+    std::cout << hessian[0][0] << " " << hessian[1][0] << " | "
+              << 2.0 * bv + bv * bv * ev << " "
+              << 2.0 * av + ev + av * bv * ev << '\n';
+    std::cout << hessian[0][1] << " " << hessian[1][1] << " | "
+              << 2.0 * av + ev + av * bv * ev << " " << av * av * ev << '\n';
+
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include <micrograd/nn.hpp>
+#include <micrograd/optim.hpp>
+#include <chrono>
+
+#define SIZE 2
+#define FEATURES 20000
+#define WORDS 8
+#define BATCH 16
+typedef double TYPE;
+
+int main() {
+    // Bag of words: every sample has WORDS non zero features out of
+    // FEATURES and the target is the sign of a hidden linear model
+    Random rng(42);
+    std::vector<TYPE> hidden(FEATURES);
+    rng.fill_uniform(hidden.data(), hidden.size(), TYPE(-1.0), TYPE(1.0));
+
+    std::vector<Sparse_Vec<TYPE>> inputs(2000);
+    Value_Vec<TYPE> targets;
+    for (auto &x : inputs) {
+        x.size = FEATURES;
+        TYPE score = 0.0;
+        for (size_t k = 0; k < WORDS; k++) {
+            const size_t word = rng.next() % FEATURES;
+            x.indices.push_back(word);
+            x.values.emplace_back(1.0);
+            score += hidden[word];
+        }
+        targets.emplace_back(score > 0.0 ? 1.0 : -1.0);
+    }
+
+    auto model = MLP<TYPE, SIZE>(FEATURES, {8, 1});
+    std::cout << model << '\n';
+
+    auto optimizer = SGD<TYPE>(model.parameters(), 0.1, 0.0001);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t epoch = 0; epoch < 20; epoch++) {
+        TYPE epoch_loss = 0.0;
+        for (size_t b = 0; b < inputs.size(); b += BATCH) {
+            GraphScope<TYPE> scope;
+            Value_Vec<TYPE> outputs, batch_targets;
+            for (size_t i = b; i < std::min(b + BATCH, inputs.size()); i++) {
+                outputs.emplace_back(model(inputs[i])[0]);
+                batch_targets.push_back(targets[i]);
+            }
+
+            auto loss = hinge_loss(outputs, batch_targets);
+            loss.backward();
+            epoch_loss += loss.data;
+
+            // Only the weights of the words in the batch are updated
+            optimizer.step(model.touched_parameters());
+            model.zero_touched_grad();
+        }
+        if (epoch % 5 == 4) {
+            std::cout << " epoch: " << epoch
+                      << " loss: " << epoch_loss * BATCH / inputs.size()
+                      << '\n';
+        }
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    // Bring every weight up to date before using the model
+    optimizer.flush();
+
+    size_t correct = 0;
+    GraphScope<TYPE> scope;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        correct += (model(inputs[i])[0].data > 0.0) == (targets[i].data > 0.0);
+    }
+    model.zero_touched_grad();
+
+    std::cout << " accuracy: " << 100.0 * correct / inputs.size() << " %"
+              << " time: " << elapsed.count() << " s\n";
+}
@@ -38,11 +38,10 @@ int main() {
     double lr = 0.005;
 
     for (size_t j = 1; j <= 1000; j++) {
+        GraphScope<TYPE> scope;
 
         std::vector<Value_Vec<TYPE>> ypred;
-        Value_Vec<TYPE> tmp_loss;
-        Value<TYPE> loss = Value<TYPE>(0.0, "loss");
-        // Problem is with the ^ operator
+        Value_Vec<TYPE> outputs;
 
         // Zero grad
         model.zero_grad();
@@ -53,15 +52,15 @@ int main() {
             ypred.emplace_back(model(xs[i]));
 
             /* ypred[i][0].draw_graph(); */
-            tmp_loss.emplace_back(ypred[i][0] - ys[i]);
+            outputs.emplace_back(ypred[i][0]);
         }
 
-        // I have to compute this outside to allow the gradient to propagate
-        // correctly
-        for (size_t i = 0; i < BATCH; i++) {
-            // Mean Squared Error
-            loss += tmp_loss[i] ^ 2.0;
-        }
+        // Sum of the squared errors: the mean of the fused node times the
+        // batch size, so the loss and the steps are the ones of the sum
+        auto mse = mse_loss(outputs, ys);
+        auto batch_size = Value<TYPE>(BATCH);
+        auto loss = mse * batch_size;
+        loss.label = "loss";
 
         // backward pass
         loss.backward();
@@ -0,0 +1,213 @@
+//  data.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "engine.hpp"
+#include "random.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+using namespace value_engine;
+
+// A mini batch of samples with their targets
+template <typename T> struct Batch {
+    std::vector<Value_Vec<T>> inputs;
+    Value_Vec<T> targets;
+
+    size_t size() const { return targets.size(); }
+};
+
+// Streams a dataset from disk on a background thread: the next mini batches
+// are read, parsed, shuffled and batched into a small ring of buffers while
+// the current one trains, so the training loop never waits on I/O.
+// The inputs file has num_features values per sample and the targets file one
+// value per sample (as demo/dataset/X.txt and Y.txt). Since the dataset is
+// never fully loaded, the shuffle is done through a buffer of shuffle_size
+// samples from which a random one is taken every time a new one is read
+template <typename T> class DataLoader {
+public:
+    DataLoader(std::string inputs_file, std::string targets_file,
+               size_t num_features, size_t batch_size, size_t epochs = 1,
+               size_t shuffle_size = 1024, size_t num_buffers = 2,
+               Random rng = Random());
+    ~DataLoader();
+
+    DataLoader(const DataLoader &) = delete;
+    DataLoader &operator=(const DataLoader &) = delete;
+
+    // Wait for the next mini batch, returns false once all the epochs are
+    // done. The batch is moved out, the buffer can be refilled right away
+    bool next(Batch<T> &batch);
+
+protected:
+    // Producer run by the background thread
+    void _produce();
+    // Read a single sample, returns false at the end of the files
+    bool _read_sample(std::ifstream &inputs, std::ifstream &targets,
+                      Value_Vec<T> &x, Value<T> &y);
+    // Add a sample to the batch being built and push it once it is full
+    void _add_sample(Batch<T> &batch, Value_Vec<T> &&x, Value<T> &&y);
+    // Wait for a free buffer and push the batch in the ring
+    void _push(Batch<T> &batch);
+
+protected:
+    const std::string m_inputs_file;
+    const std::string m_targets_file;
+    const size_t m_num_features;
+    const size_t m_batch_size;
+    const size_t m_epochs;
+    const size_t m_shuffle_size;
+    const size_t m_num_buffers;
+    Random m_rng;
+
+    // Ring of ready batches shared with the consumer
+    std::deque<Batch<T>> m_ready;
+    bool m_done;                // the producer pushed the last batch
+    std::atomic<bool> m_stop;  // the consumer is gone
+    std::mutex m_mutex;
+    std::condition_variable m_not_full;
+    std::condition_variable m_not_empty;
+
+    std::thread m_producer;
+};
+
+//  ================ Implementation DataLoader =================
+
+template <typename T>
+DataLoader<T>::DataLoader(std::string inputs_file, std::string targets_file,
+                          size_t num_features, size_t batch_size,
+                          size_t epochs, size_t shuffle_size,
+                          size_t num_buffers, Random rng)
+    : m_inputs_file(std::move(inputs_file)),
+      m_targets_file(std::move(targets_file)), m_num_features(num_features),
+      m_batch_size(batch_size), m_epochs(epochs),
+      m_shuffle_size(std::max(shuffle_size, size_t(1))),
+      m_num_buffers(std::max(num_buffers, size_t(1))), m_rng(rng),
+      m_done(false), m_stop(false) {
+    // Start only once every member is initialized
+    m_producer = std::thread(&DataLoader<T>::_produce, this);
+}
+
+template <typename T> DataLoader<T>::~DataLoader() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_not_full.notify_all();
+    m_producer.join();
+}
+
+template <typename T> bool DataLoader<T>::next(Batch<T> &batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] { return !m_ready.empty() || m_done; });
+    if (m_ready.empty()) {
+        return false;
+    }
+
+    batch = std::move(m_ready.front());
+    m_ready.pop_front();
+    lock.unlock();
+    m_not_full.notify_one();
+    return true;
+}
+
+template <typename T>
+bool DataLoader<T>::_read_sample(std::ifstream &inputs,
+                                 std::ifstream &targets, Value_Vec<T> &x,
+                                 Value<T> &y) {
+    x.clear();
+    x.reserve(m_num_features);
+    T value;
+    for (size_t i = 0; i < m_num_features; i++) {
+        if (!(inputs >> value)) {
+            return false;
+        }
+        x.emplace_back(value);
+    }
+    if (!(targets >> value)) {
+        return false;
+    }
+    y = Value<T>(value);
+    return true;
+}
+
+template <typename T>
+void DataLoader<T>::_add_sample(Batch<T> &batch, Value_Vec<T> &&x,
+                                Value<T> &&y) {
+    batch.inputs.push_back(std::move(x));
+    batch.targets.push_back(std::move(y));
+    if (batch.size() == m_batch_size) {
+        _push(batch);
+    }
+}
+
+template <typename T> void DataLoader<T>::_push(Batch<T> &batch) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_not_full.wait(lock, [this] {
+            return m_ready.size() < m_num_buffers || m_stop;
+        });
+        if (!m_stop) {
+            m_ready.push_back(std::move(batch));
+        }
+    }
+    m_not_empty.notify_one();
+    batch = Batch<T>();
+}
+
+template <typename T> void DataLoader<T>::_produce() {
+    Batch<T> batch;
+    std::vector<std::pair<Value_Vec<T>, Value<T>>> shuffle;
+    Value_Vec<T> x;
+    Value<T> y(0.0);
+
+    for (size_t epoch = 0; epoch < m_epochs && !m_stop; epoch++) {
+        std::ifstream inputs(m_inputs_file);
+        std::ifstream targets(m_targets_file);
+        if (!inputs.is_open() || !targets.is_open()) {
+            std::cerr << "Error: failed to open " << m_inputs_file << " or "
+                      << m_targets_file << '\n';
+            break;
+        }
+
+        // Every epoch has its own order
+        Random rng = m_rng.split(epoch);
+        while (!m_stop && _read_sample(inputs, targets, x, y)) {
+            if (shuffle.size() < m_shuffle_size) {
+                shuffle.emplace_back(std::move(x), std::move(y));
+                continue;
+            }
+            // Take a random sample out of the buffer and put the new one in
+            // its place
+            auto &slot = shuffle[rng.next() % shuffle.size()];
+            _add_sample(batch, std::move(slot.first), std::move(slot.second));
+            slot = {std::move(x), std::move(y)};
+        }
+
+        // Drain what is left in the buffer in random order
+        while (!shuffle.empty() && !m_stop) {
+            std::swap(shuffle[rng.next() % shuffle.size()], shuffle.back());
+            _add_sample(batch, std::move(shuffle.back().first),
+                        std::move(shuffle.back().second));
+            shuffle.pop_back();
+        }
+    }
+
+    // Last partial batch
+    if (batch.size() > 0 && !m_stop) {
+        _push(batch);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_not_empty.notify_all();
+}
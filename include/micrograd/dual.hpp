@@ -0,0 +1,244 @@
+//  dual.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+namespace value_engine {
+
+// Forward mode autodiff: a dual number carries its value and K directional
+// derivatives (tangents) which are updated alongside every op, so a single
+// forward pass gives K Jacobian vector products without building any graph
+template <typename T, size_t K = 1> class Dual {
+ public:
+    T data;                    // value
+    std::array<T, K> tangent;  // derivatives along the K directions
+
+ public:
+    // Constructor, a constant has zero tangents
+    Dual(T data = 0.0) : data(data), tangent{} {}
+    Dual(T data, const std::array<T, K> &tangent)
+        : data(data), tangent(tangent) {}
+
+    // Operator Overloading
+    friend Dual operator+(const Dual &lhs, const Dual &rhs) {
+        Dual out(lhs.data + rhs.data);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] = lhs.tangent[k] + rhs.tangent[k];
+        }
+        return out;
+    }
+
+    friend Dual operator-(const Dual &lhs, const Dual &rhs) {
+        Dual out(lhs.data - rhs.data);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] = lhs.tangent[k] - rhs.tangent[k];
+        }
+        return out;
+    }
+
+    friend Dual operator*(const Dual &lhs, const Dual &rhs) {
+        Dual out(lhs.data * rhs.data);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] =
+                lhs.tangent[k] * rhs.data + lhs.data * rhs.tangent[k];
+        }
+        return out;
+    }
+
+    friend Dual operator/(const Dual &lhs, const Dual &rhs) {
+        const T inv = 1.0 / rhs.data;
+        Dual out(lhs.data * inv);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] =
+                (lhs.tangent[k] - out.data * rhs.tangent[k]) * inv;
+        }
+        return out;
+    }
+
+    friend Dual operator^(const Dual &lhs, const Dual &rhs) {
+        Dual out(std::pow(lhs.data, rhs.data));
+        const T d_base = rhs.data * std::pow(lhs.data, rhs.data - 1.0);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] = d_base * lhs.tangent[k];
+            // the log is only needed if the exponent is not a constant
+            if (rhs.tangent[k] != 0.0) {
+                out.tangent[k] +=
+                    out.data * std::log(lhs.data) * rhs.tangent[k];
+            }
+        }
+        return out;
+    }
+
+    // Product by a constant, used by the neurons with the weights
+    friend Dual operator*(const Dual &lhs, T rhs) {
+        Dual out(lhs.data * rhs);
+        for (size_t k = 0; k < K; k++) {
+            out.tangent[k] = lhs.tangent[k] * rhs;
+        }
+        return out;
+    }
+
+    friend Dual operator-(const Dual &d) { return d * T(-1.0); }
+
+    // Comparisons only look at the value
+    friend bool operator<(const Dual &lhs, const Dual &rhs) {
+        return lhs.data < rhs.data;
+    }
+    friend bool operator>(const Dual &lhs, const Dual &rhs) {
+        return lhs.data > rhs.data;
+    }
+    friend bool operator<=(const Dual &lhs, const Dual &rhs) {
+        return lhs.data <= rhs.data;
+    }
+    friend bool operator>=(const Dual &lhs, const Dual &rhs) {
+        return lhs.data >= rhs.data;
+    }
+    friend bool operator==(const Dual &lhs, const Dual &rhs) {
+        return lhs.data == rhs.data;
+    }
+    friend bool operator!=(const Dual &lhs, const Dual &rhs) {
+        return lhs.data != rhs.data;
+    }
+
+    // Math functions found through ADL by the engine
+    friend Dual pow(const Dual &lhs, const Dual &rhs) { return lhs ^ rhs; }
+    friend Dual exp(const Dual &d) { return d.exp_value(); }
+    friend Dual tanh(const Dual &d) { return d.tanh(); }
+    friend Dual log(const Dual &d) {
+        return d._unary(std::log(d.data), 1.0 / d.data);
+    }
+    friend Dual abs(const Dual &d) { return d.data < 0.0 ? -d : d; }
+
+    Dual &operator+=(const Dual &rhs) {
+        data += rhs.data;
+        for (size_t k = 0; k < K; k++) {
+            tangent[k] += rhs.tangent[k];
+        }
+        return *this;
+    }
+
+    Dual &operator-=(const Dual &rhs) {
+        data -= rhs.data;
+        for (size_t k = 0; k < K; k++) {
+            tangent[k] -= rhs.tangent[k];
+        }
+        return *this;
+    }
+
+    // << operator overload
+    friend std::ostream &operator<<(std::ostream &os, const Dual &d) {
+        os << std::fixed;
+        os << std::setprecision(16);
+        os << "Dual(data=" << d.data << ", tangent=[";
+        for (size_t k = 0; k < K; k++) {
+            os << (k == 0 ? "" : ", ") << d.tangent[k];
+        }
+        os << "])";
+        return os;
+    }
+
+    // Other ops, same as the ones of Value
+    Dual inverse_value() const;
+    Dual exp_value() const;
+    Dual tanh() const;
+    Dual relu() const;
+    Dual lrelu() const;
+    Dual swish() const;
+
+ protected:
+    // Apply the chain rule with the local derivative of an unary op
+    Dual _unary(T data, T derivative) const;
+};
+
+// ==================== Implementation =====================
+
+template <typename T, size_t K>
+Dual<T, K> Dual<T, K>::_unary(T out_data, T derivative) const {
+    Dual out(out_data);
+    for (size_t k = 0; k < K; k++) {
+        out.tangent[k] = derivative * tangent[k];
+    }
+    return out;
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::inverse_value() const {
+    const T inv = 1.0 / data;
+    return _unary(inv, -inv * inv);
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::exp_value() const {
+    const T e = std::exp(data);
+    return _unary(e, e);
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::tanh() const {
+    const T t = std::tanh(data);
+    return _unary(t, 1.0 - t * t);
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::relu() const {
+    // 0 at 0 like the backward of Value::relu
+    return data > 0.0 ? _unary(data, 1.0) : _unary(0.0, 0.0);
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::lrelu() const {
+    return data > 0.0 ? _unary(data, 1.0) : _unary(0.01 * data, 0.01);
+}
+
+template <typename T, size_t K> Dual<T, K> Dual<T, K>::swish() const {
+    // swish = x * sigmoid(x) and f'(x) = f(x) + sigmoid(x)(1 - f(x))
+    const T sigmoid = 1.0 / (1.0 + std::exp(-data));
+    const T f = data * sigmoid;
+    return _unary(f, f + sigmoid * (1.0 - f));
+}
+
+// ==================== Jacobians =====================
+
+// Jacobian vector products of f at x along the K directions v, f maps a
+// std::vector<Dual<T, K>> to a std::vector<Dual<T, K>>
+template <size_t K, typename T, typename F>
+std::vector<Dual<T, K>> jvp(F &&f, const std::vector<T> &x,
+                            const std::array<std::vector<T>, K> &v) {
+    std::vector<Dual<T, K>> inputs(x.begin(), x.end());
+    for (size_t i = 0; i < x.size(); i++) {
+        for (size_t k = 0; k < K; k++) {
+            inputs[i].tangent[k] = v[k][i];
+        }
+    }
+    return f(inputs);
+}
+
+// Full Jacobian (outputs x inputs) of f at x, K columns for each forward pass
+template <size_t K = 4, typename T, typename F>
+std::vector<std::vector<T>> jacobian_forward(F &&f, const std::vector<T> &x) {
+    std::vector<std::vector<T>> jacobian;
+    std::vector<Dual<T, K>> inputs(x.begin(), x.end());
+
+    for (size_t col = 0; col < x.size(); col += K) {
+        // Seed the tangents with the columns [col, col + K) of the identity
+        for (size_t i = 0; i < x.size(); i++) {
+            for (size_t k = 0; k < K; k++) {
+                inputs[i].tangent[k] = (i == col + k) ? 1.0 : 0.0;
+            }
+        }
+
+        auto outputs = f(inputs);
+        jacobian.resize(outputs.size(), std::vector<T>(x.size()));
+        for (size_t j = 0; j < outputs.size(); j++) {
+            for (size_t k = 0; k < K && col + k < x.size(); k++) {
+                jacobian[j][col + k] = outputs[j].tangent[k];
+            }
+        }
+    }
+    return jacobian;
+}
+}  // namespace value_engine
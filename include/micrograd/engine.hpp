@@ -6,15 +6,25 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#ifdef MICROGRAD_DEBUG_GRAPH
+#include <mutex>
+#endif
+
 namespace value_engine {
 
 enum ops_type : char {
@@ -28,9 +38,116 @@ enum ops_type : char {
     TANH = 't',
     RELU = 'r',
     LRELU = 'l',
-    SWISH = 's'
+    SWISH = 's',
+    // n-ary ops, their operands live in m_operands
+    SUM = 'S',
+    MEAN = 'M',
+    DOT = 'D',
+    MAX = 'm',
+    LSE = 'L',
+    SOFTMAX = 'x',
+    XENT = 'c',
+    // fused losses, operands are the predictions followed by the targets
+    HINGE = 'h',
+    MSE = 'q',
+    BCE = 'b',
+    // expression fused at compile time, see expr.hpp
+    FUSED = 'f'
+};
+
+// Math functions resolved through ADL, so that Value also works on scalar
+// types other than the builtin ones (e.g. Value<Dual<T>> for forward over
+// reverse)
+namespace math {
+template <typename U> U exp(const U &x) {
+    using std::exp;
+    return exp(x);
+}
+template <typename U> U log(const U &x) {
+    using std::log;
+    return log(x);
+}
+template <typename U> U tanh(const U &x) {
+    using std::tanh;
+    return tanh(x);
+}
+template <typename U> U abs(const U &x) {
+    using std::abs;
+    return abs(x);
+}
+template <typename U, typename V> U pow(const U &x, const V &y) {
+    using std::pow;
+    return pow(x, y);
+}
+}  // namespace math
+
+template <typename T> class Value;
+template <typename T> class Tape;
+template <typename T> class GraphScope;
+
+// Backward schedule of a root, built on its first backward: the values of its
+// graph with children grouped by level and op and the end of every group.
+// Only the root holds one, the other values only keep a null pointer
+template <typename T> struct _Schedule {
+    std::vector<Value<T> *> sorted_values;
+    std::vector<size_t> runs;
 };
 
+#ifdef MICROGRAD_DEBUG_GRAPH
+// Debug only: registry of the live values, every value has one of these as a
+// member so that check_graph can tell the children which were destroyed
+// while the graph still points to them
+class _Live_Values {
+ public:
+    _Live_Values() { _insert(this); }
+    _Live_Values(const _Live_Values &) { _insert(this); }
+    _Live_Values &operator=(const _Live_Values &) { return *this; }
+    ~_Live_Values() {
+        std::lock_guard<std::mutex> lock(_mutex());
+        _registry().erase(this);
+    }
+
+    static bool alive(const _Live_Values *live) {
+        std::lock_guard<std::mutex> lock(_mutex());
+        return _registry().count(live) != 0;
+    }
+    static size_t count() {
+        std::lock_guard<std::mutex> lock(_mutex());
+        return _registry().size();
+    }
+
+ protected:
+    static void _insert(const _Live_Values *live) {
+        std::lock_guard<std::mutex> lock(_mutex());
+        _registry().insert(live);
+    }
+    static std::unordered_set<const _Live_Values *> &_registry() {
+        static std::unordered_set<const _Live_Values *> registry;
+        return registry;
+    }
+    static std::mutex &_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+};
+#endif
+
+// Compiled expression held by a FUSED value: it evaluates the whole
+// expression from its leaves and applies its generated backward
+template <typename T> class FusedExpr {
+ public:
+    virtual ~FusedExpr() {}
+    virtual T forward() = 0;
+    virtual void backward(T grad) = 0;
+};
+
+template <typename T> using Value_Vec = std::vector<Value<T>>;
+
+template <typename T> Value_Vec<T> softmax(const Value_Vec<T> &x);
+template <typename T>
+Value<T> cross_entropy_loss(const std::vector<Value_Vec<T>> &logits,
+                            const std::vector<size_t> &targets);
+
 template <typename T> class Value {
  public:
     std::string label;  // label of the value
@@ -40,19 +157,42 @@ template <typename T> class Value {
     /* protected: */
  protected:
     char m_op;
+    // position + 1 of the value while a backward schedules its graph, zero
+    // otherwise. Only the values with children are marked, the leaves (e.g.
+    // the parameters shared by the hogwild threads) are never written
+    uint32_t m_order;
     std::array<Value<T> *, 2> m_prev;  // previous values
-    // vector to store the sorted values
-    std::vector<Value<T> *> m_sorted_values;
-    //// keep track of the visited nodes
-    std::unordered_set<Value<T> *> m_visited;
+    // operands of the n-ary ops, for MAX and XENT m_prev[0] also points to
+    // the selected operand
+    std::vector<Value<T> *> m_operands;
+    // forward intermediate reused by the backward: 1 / b for DIV,
+    // b * a^(b - 1) for POW and sigmoid(x) for SWISH
+    T m_cache;
+    // sorted values of the graph of this value once it is the root of a
+    // backward
+    std::shared_ptr<_Schedule<T>> m_schedule;
     std::vector<std::shared_ptr<Value<T>>> m_tmp_value;
+    // expression of a FUSED value, the operands are its leaves
+    std::shared_ptr<FusedExpr<T>> m_fused;
+#ifdef MICROGRAD_DEBUG_GRAPH
+    _Live_Values m_live;
+#endif
 
  public:
     // Constructor
     Value(T data, std::string label = "", char op = ' ',
-          std::array<Value<T> *, 2> children = {nullptr, nullptr})
-        : label(label), data(data), grad(0.0), m_op(op),
-          m_prev(std::move(children)) {}
+          std::array<Value<T> *, 2> children = {nullptr, nullptr},
+          std::vector<Value<T> *> operands = {})
+        : label(label), data(data), grad(0.0), m_op(op), m_order(0),
+          m_prev(std::move(children)), m_operands(std::move(operands)),
+          m_cache(0.0) {}
+
+    // Fused value computed by the expression from the operands
+    Value(std::shared_ptr<FusedExpr<T>> fused,
+          std::vector<Value<T> *> operands)
+        : data(fused->forward()), grad(0.0), m_op(FUSED), m_order(0),
+          m_prev({nullptr, nullptr}), m_operands(std::move(operands)),
+          m_cache(0.0), m_fused(std::move(fused)) {}
 
     // Operator Overloading
     // lvalues and rvalues because of const reference
@@ -72,34 +212,35 @@ template <typename T> class Value {
     }
 
     friend Value operator/(const Value &lhs, const Value &rhs) {
-        return Value(lhs.data / rhs.data, "", DIV,
-                     {const_cast<Value *>(&lhs), const_cast<Value *>(&rhs)});
+        const T inv = 1.0 / rhs.data;
+        Value out(lhs.data * inv, "", DIV,
+                  {const_cast<Value *>(&lhs), const_cast<Value *>(&rhs)});
+        out.m_cache = inv;
+        return out;
     }
 
     friend Value operator^(const Value &lhs, const Value &rhs) {
-        return Value(std::pow(lhs.data, rhs.data), "", POW,
-                     {const_cast<Value *>(&lhs), const_cast<Value *>(&rhs)});
+        Value out(math::pow(lhs.data, rhs.data), "", POW,
+                  {const_cast<Value *>(&lhs), const_cast<Value *>(&rhs)});
+        // b * a^(b - 1) = b * a^b / a which avoids a second pow
+        out.m_cache = lhs.data != 0.0
+                          ? rhs.data * out.data / lhs.data
+                          : rhs.data * math::pow(lhs.data, rhs.data - 1.0);
+        return out;
     }
 
-    friend Value operator+=(Value &lhs, const Value &rhs) {
-
-        /* lhs.m_tmp_value.push_back(std::make_shared<Value<T>>(lhs.data,
-         * lhs.label, lhs.m_op, lhs.m_prev)); */
-        /* const_cast<Value
-         * *>(&rhs)->m_tmp_value.push_back(std::make_shared<Value<T>>(rhs.data,
-         * rhs.label, rhs.m_op, rhs.m_prev)); */
-
-        auto tmp1 = new Value<T>(lhs.data, lhs.label, lhs.m_op, lhs.m_prev);
-        auto tmp2 = new Value<T>(rhs.data, rhs.label, rhs.m_op, rhs.m_prev);
-
-        if (rhs.m_prev[0] == nullptr) {
-            lhs = *tmp1 + rhs;
-            /* lhs = *(lhs.m_tmp_value.back()) + rhs; */
-        } else {
-            /* lhs = *(lhs.m_tmp_value.back()) + *(rhs.m_tmp_value.back()); */
-            lhs = *tmp1 + *tmp2;
-        }
-
+    friend Value &operator+=(Value &lhs, const Value &rhs) {
+        // lhs becomes lhs + rhs so its old value has to be kept somewhere,
+        // and so does rhs which may be a temporary. A leaf is used directly
+        // so that the gradient goes to the caller's value (e.g. the bias).
+        // The values lhs owned move to the new lhs instead of its old copy
+        std::vector<std::shared_ptr<Value>> owned = std::move(lhs.m_tmp_value);
+        lhs.m_tmp_value.clear();
+        Value *old_lhs = _keep(Value(lhs), owned);
+        const Value *kept_rhs =
+            rhs.m_op == ' ' ? &rhs : _keep(Value(rhs), owned);
+        lhs = *old_lhs + *kept_rhs;
+        lhs.m_tmp_value = std::move(owned);
         return lhs;
     }
 
@@ -120,34 +261,182 @@ template <typename T> class Value {
     Value<T> lrelu();
     Value<T> swish();
 
+    // softmax needs to keep the shared log-sum-exp node alive
+    friend Value_Vec<T> softmax<T>(const Value_Vec<T> &x);
+    // and cross_entropy_loss the cross entropy of every sample
+    friend Value<T>
+    cross_entropy_loss<T>(const std::vector<Value_Vec<T>> &logits,
+                          const std::vector<size_t> &targets);
+
     void backward();
     void draw_graph();
 
+    // The tape records the graph to sweep it multiple times
+    friend class Tape<T>;
+#ifdef MICROGRAD_DEBUG_GRAPH
+    template <typename U> friend size_t check_graph(const Value<U> &root);
+#endif
+
  protected:
-    // Helper function to make a topological sort
-    void _topo_sort(Value<T> *v);
+    // Topological sort grouped by level and op for the kernels
+    void _schedule();
     void _backward_single();  // 1 step of backdrop
+    // Recompute data (and m_cache) from the children, used by Tape::forward
+    void _forward_single();
+
+    // Backward kernel of an op: applies the chain rule to n values of that op
+    using Kernel = void (*)(Value<T> *const *values, size_t n);
+    template <char OP>
+    static void _backward_kernel(Value<T> *const *values, size_t n);
+    // Table of the kernels indexed by op
+    static const std::array<Kernel, 256> &_kernels();
+
+    // Move a copy of a value used by the graph to the current GraphScope,
+    // without a scope to owned, which the value using it has to hold
+    static Value<T> *_keep(Value<T> &&v,
+                           std::vector<std::shared_ptr<Value<T>>> &owned);
 };
 
 // Adding aliases
-template <typename T> using Value_Vec = std::vector<Value<T>>;
 template <typename T>
 using Value_Vec_Ptr = std::vector<std::shared_ptr<Value<T>>>;
 template <typename T>
 using Ptr_Value_Vec = std::shared_ptr<std::vector<Value<T>>>;
 
+// Sparse vector of the given size: only the values at indices are non zero
+// (e.g. one-hot or bag of words features)
+template <typename T> struct Sparse_Vec {
+    std::vector<size_t> indices;
+    Value_Vec<T> values;
+    size_t size;
+};
+
+// ==================== Graph lifetime =====================
+
+// Owns the values of the graph built on this thread while it is alive: the
+// temporaries of operator+= and the intermediates of the modules (nn.hpp) go
+// in it, and they are all released together when the scope is destroyed.
+// Without a scope the temporaries of operator+= are owned by the value it
+// returns (one shared_ptr each) and the intermediates of the modules by the
+// modules until zero_grad. The values are stored in
+// blocks (std::deque), so adding one is an append and addresses never move;
+// the release is one destructor call per value and one free per block.
+// Scopes nest and the innermost one is used. Nothing built inside a scope can
+// be used after it, so build, backward and step inside it:
+//
+//     for (size_t epoch = 0; epoch < epochs; ++epoch) {
+//         GraphScope<double> scope;
+//         ...
+//     }
+template <typename T> class GraphScope {
+ public:
+    GraphScope() : m_parent(_current()), m_token(std::make_shared<int>(0)) {
+        _current() = this;
+    }
+    ~GraphScope() { _current() = m_parent; }
+
+    GraphScope(const GraphScope &) = delete;
+    GraphScope &operator=(const GraphScope &) = delete;
+
+    // Innermost scope of this thread, nullptr if there is none
+    static GraphScope *current() { return _current(); }
+
+    Value<T> *make(Value<T> &&v) {
+        return &m_values.emplace_back(std::move(v));
+    }
+    Value_Vec<T> *make(Value_Vec<T> &&v) {
+        return &m_vectors.emplace_back(std::move(v));
+    }
+
+    // Number of values owned directly, without the ones in the vectors
+    size_t size() const { return m_values.size(); }
+
+    // Expires with the scope, for the pointers into it kept by the modules
+    std::weak_ptr<void> token() const { return m_token; }
+
+ protected:
+    static GraphScope *&_current() {
+        thread_local GraphScope *current = nullptr;
+        return current;
+    }
+
+ protected:
+    GraphScope *m_parent;
+    std::shared_ptr<int> m_token;
+    std::deque<Value<T>> m_values;
+    std::deque<Value_Vec<T>> m_vectors;
+};
+
+#ifdef MICROGRAD_DEBUG_GRAPH
+// Walk the graph of root and report on std::cerr every child (m_prev or
+// m_operands) which was already destroyed, returns how many there are. Only
+// the address of the member of the child is computed, the child is never
+// read. An address reused by a newer value can hide a dangling child
+template <typename T> size_t check_graph(const Value<T> &root) {
+    size_t dangling = 0;
+    std::unordered_set<const Value<T> *> visited = {&root};
+    std::vector<const Value<T> *> stack = {&root};
+
+    while (!stack.empty()) {
+        const Value<T> *v = stack.back();
+        stack.pop_back();
+
+        auto check = [&](const Value<T> *child) {
+            if (child == nullptr) {
+                return;
+            }
+            if (!_Live_Values::alive(&child->m_live)) {
+                std::cerr << "dangling child " << child << " of the value "
+                          << v << " (op '" << v->m_op << "' label \""
+                          << v->label << "\")\n";
+                dangling++;
+            } else if (visited.insert(child).second) {
+                stack.push_back(child);
+            }
+        };
+        for (auto *child : v->m_prev) {
+            check(child);
+        }
+        for (auto *child : v->m_operands) {
+            check(child);
+        }
+    }
+    return dangling;
+}
+
+// Number of values alive on every thread
+inline size_t live_values() { return _Live_Values::count(); }
+#endif
+
 // ==================== Implementation =====================
 
+template <typename T>
+Value<T> *Value<T>::_keep(Value<T> &&v,
+                          std::vector<std::shared_ptr<Value<T>>> &owned) {
+    v.grad = 0.0;
+    if (GraphScope<T> *scope = GraphScope<T>::current()) {
+        return scope->make(std::move(v));
+    }
+    // What v owns goes to owned as well, so that however long a chain of
+    // += gets its values are released in a loop and not recursively
+    for (auto &tmp : v.m_tmp_value) {
+        owned.push_back(std::move(tmp));
+    }
+    v.m_tmp_value.clear();
+    owned.push_back(std::make_shared<Value<T>>(std::move(v)));
+    return owned.back().get();
+}
+
 template <typename T> Value<T> Value<T>::inverse_value() {
     return Value(1.0 / this->data, "", INV, {this, nullptr});
 }
 
 template <typename T> Value<T> Value<T>::exp_value() {
-    return Value<T>(std::exp(data), "", EXP, {this, nullptr});
+    return Value<T>(math::exp(data), "", EXP, {this, nullptr});
 }
 
 template <typename T> Value<T> Value<T>::tanh() {
-    return Value<T>(std::tanh(data), "", TANH, {this, nullptr});
+    return Value<T>(math::tanh(data), "", TANH, {this, nullptr});
 }
 
 template <typename T> Value<T> Value<T>::relu() {
@@ -162,104 +451,647 @@ template <typename T> Value<T> Value<T>::lrelu() {
 template <typename T> Value<T> Value<T>::swish() {
     // swish = x * sigmoid(x)
     // sigmoid = 1/(1 + e^-x)
-    return Value<T>(data / (1.0 + std::exp(-data)), "", SWISH, {this, nullptr});
+    const T sigmoid = 1.0 / (1.0 + math::exp(-data));
+    Value<T> out(data * sigmoid, "", SWISH, {this, nullptr});
+    out.m_cache = sigmoid;
+    return out;
+}
+
+// ==================== N-ary ops =====================
+// Each of them is a single node in the graph with a single backward step,
+// so reducing thousands of values does not build a chain of thousands of ADD
+
+// Collect the addresses of the values to use them as operands
+template <typename T>
+std::vector<Value<T> *> _operands(const Value_Vec<T> &x) {
+    std::vector<Value<T> *> operands;
+    operands.reserve(x.size());
+    for (auto &v : x) {
+        operands.push_back(const_cast<Value<T> *>(&v));
+    }
+    return operands;
+}
+
+// Operands of lhs followed by the ones of rhs
+template <typename T>
+std::vector<Value<T> *> _operands(const Value_Vec<T> &lhs,
+                                  const Value_Vec<T> &rhs) {
+    auto operands = _operands(lhs);
+    auto rhs_operands = _operands(rhs);
+    operands.insert(operands.end(), rhs_operands.begin(), rhs_operands.end());
+    return operands;
+}
+
+// The ops reading x[0] or dividing by the size need at least one operand
+template <typename T>
+void _check_not_empty(const Value_Vec<T> &x, const char *op) {
+    if (x.empty()) {
+        throw std::invalid_argument(std::string(op) + " of an empty vector");
+    }
+}
+
+// Every index of a sparse vector must have a value and be below size, the
+// callers index dense vectors of that size with them
+template <typename T> void _check_sparse(const Sparse_Vec<T> &x, size_t size) {
+    if (x.indices.size() != x.values.size()) {
+        throw std::invalid_argument(
+            "sparse vector with a different number of indices and values");
+    }
+    for (size_t i : x.indices) {
+        if (i >= size) {
+            throw std::out_of_range("sparse vector index out of range");
+        }
+    }
+}
+
+// Numerically stable log(sum(e^x))
+template <typename T> T _log_sum_exp(const Value_Vec<T> &x) {
+    _check_not_empty(x, "log_sum_exp");
+    T max = x[0].data;
+    for (auto &v : x) {
+        max = std::max(max, v.data);
+    }
+    T sum = 0.0;
+    for (auto &v : x) {
+        sum += math::exp(v.data - max);
+    }
+    return max + math::log(sum);
+}
+
+template <typename T> Value<T> sum(const Value_Vec<T> &x) {
+    T total = 0.0;
+    for (auto &v : x) {
+        total += v.data;
+    }
+    return Value<T>(total, "", SUM, {nullptr, nullptr}, _operands(x));
+}
+
+template <typename T> Value<T> mean(const Value_Vec<T> &x) {
+    _check_not_empty(x, "mean");
+    T total = 0.0;
+    for (auto &v : x) {
+        total += v.data;
+    }
+    return Value<T>(total / x.size(), "", MEAN, {nullptr, nullptr},
+                    _operands(x));
+}
+
+template <typename T>
+Value<T> dot(const Value_Vec<T> &lhs, const Value_Vec<T> &rhs) {
+    // The backward splits the operands in two halves
+    if (lhs.size() != rhs.size()) {
+        throw std::invalid_argument("dot of vectors of different sizes");
+    }
+    T total = 0.0;
+    for (size_t i = 0; i < lhs.size(); i++) {
+        total += lhs[i].data * rhs[i].data;
+    }
+    return Value<T>(total, "", DOT, {nullptr, nullptr}, _operands(lhs, rhs));
+}
+
+// Dot product with a sparse vector: only the entries of lhs at rhs.indices
+// become operands, so the backward never visits the others
+template <typename T>
+Value<T> dot(const Value_Vec<T> &lhs, const Sparse_Vec<T> &rhs) {
+    _check_sparse(rhs, lhs.size());
+    const size_t n = rhs.indices.size();
+    std::vector<Value<T> *> operands(2 * n);
+    T total = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        const Value<T> &l = lhs[rhs.indices[i]];
+        total += l.data * rhs.values[i].data;
+        operands[i] = const_cast<Value<T> *>(&l);
+        operands[n + i] = const_cast<Value<T> *>(&rhs.values[i]);
+    }
+    return Value<T>(total, "", DOT, {nullptr, nullptr}, std::move(operands));
+}
+
+template <typename T> Value<T> max(const Value_Vec<T> &x) {
+    _check_not_empty(x, "max");
+    size_t arg_max = 0;
+    for (size_t i = 1; i < x.size(); i++) {
+        if (x[i].data > x[arg_max].data) {
+            arg_max = i;
+        }
+    }
+    // Only the max receives the gradient
+    return Value<T>(x[arg_max].data, "", MAX,
+                    {const_cast<Value<T> *>(&x[arg_max]), nullptr},
+                    _operands(x));
+}
+
+template <typename T> Value<T> log_sum_exp(const Value_Vec<T> &x) {
+    return Value<T>(_log_sum_exp(x), "", LSE, {nullptr, nullptr},
+                    _operands(x));
+}
+
+template <typename T> Value_Vec<T> softmax(const Value_Vec<T> &x) {
+    // softmax(x)_i = e^(x_i - lse(x)), all the outputs share the same lse node
+    // so the whole softmax costs O(n) both forward and backward
+    _check_not_empty(x, "softmax");
+    auto lse = std::make_shared<Value<T>>(log_sum_exp(x));
+
+    Value_Vec<T> out;
+    out.reserve(x.size());
+    for (auto &v : x) {
+        out.emplace_back(math::exp(v.data - lse->data), "", SOFTMAX,
+                         std::array<Value<T> *, 2>{const_cast<Value<T> *>(&v),
+                                                   lse.get()});
+        out.back().m_tmp_value.push_back(lse);
+    }
+    return out;
+}
+
+// Cross entropy of the logits x with respect to the target class:
+// lse(x) - x[target]
+template <typename T>
+Value<T> cross_entropy(const Value_Vec<T> &x, size_t target) {
+    _check_not_empty(x, "cross_entropy");
+    if (target >= x.size()) {
+        throw std::out_of_range("cross_entropy target out of range");
+    }
+    return Value<T>(_log_sum_exp(x) - x[target].data, "", XENT,
+                    {const_cast<Value<T> *>(&x[target]), nullptr},
+                    _operands(x));
+}
+
+// ==================== Fused losses =====================
+// The whole loss over the batch is a single node which seeds the gradient of
+// every prediction analytically, the targets are treated as constants
+
+// The backward splits the operands in predictions and targets and the loss
+// is their mean
+template <typename T>
+void _check_loss(const Value_Vec<T> &predictions, const Value_Vec<T> &targets,
+                 const char *loss) {
+    if (predictions.empty() || predictions.size() != targets.size()) {
+        throw std::invalid_argument(std::string(loss) +
+                                    " needs as many targets as predictions");
+    }
+}
+
+// svm "max-margin" loss: mean(relu(1 - y * score))
+template <typename T>
+Value<T> hinge_loss(const Value_Vec<T> &scores, const Value_Vec<T> &targets) {
+    _check_loss(scores, targets, "hinge_loss");
+    T total = 0.0;
+    for (size_t i = 0; i < scores.size(); i++) {
+        total += std::max(T(0.0), T(1.0) - targets[i].data * scores[i].data);
+    }
+    return Value<T>(total / scores.size(), "", HINGE, {nullptr, nullptr},
+                    _operands(scores, targets));
+}
+
+// Mean squared error: mean((y_pred - y)^2)
+template <typename T>
+Value<T> mse_loss(const Value_Vec<T> &y_pred, const Value_Vec<T> &targets) {
+    _check_loss(y_pred, targets, "mse_loss");
+    T total = 0.0;
+    for (size_t i = 0; i < y_pred.size(); i++) {
+        const T diff = y_pred[i].data - targets[i].data;
+        total += diff * diff;
+    }
+    return Value<T>(total / y_pred.size(), "", MSE, {nullptr, nullptr},
+                    _operands(y_pred, targets));
+}
+
+// Binary cross entropy on the logits with targets in {0, 1}:
+// mean(log(1 + e^x) - y * x) computed in a numerically stable way
+template <typename T>
+Value<T> bce_loss(const Value_Vec<T> &logits, const Value_Vec<T> &targets) {
+    _check_loss(logits, targets, "bce_loss");
+    T total = 0.0;
+    for (size_t i = 0; i < logits.size(); i++) {
+        const T x = logits[i].data;
+        total += std::max(x, T(0.0)) - targets[i].data * x +
+                 math::log(1.0 + math::exp(-math::abs(x)));
+    }
+    return Value<T>(total / logits.size(), "", BCE, {nullptr, nullptr},
+                    _operands(logits, targets));
+}
+
+// Mean of the cross entropy of every sample, each sample is a single XENT
+// node owned by the returned loss
+template <typename T>
+Value<T> cross_entropy_loss(const std::vector<Value_Vec<T>> &logits,
+                            const std::vector<size_t> &targets) {
+    if (logits.empty() || logits.size() != targets.size()) {
+        throw std::invalid_argument(
+            "cross_entropy_loss needs as many targets as samples");
+    }
+    std::vector<std::shared_ptr<Value<T>>> losses;
+    std::vector<Value<T> *> operands;
+    T total = 0.0;
+    for (size_t i = 0; i < logits.size(); i++) {
+        losses.push_back(std::make_shared<Value<T>>(
+            cross_entropy(logits[i], targets[i])));
+        operands.push_back(losses.back().get());
+        total += losses.back()->data;
+    }
+
+    Value<T> loss(total / logits.size(), "", MEAN, {nullptr, nullptr},
+                  std::move(operands));
+    loss.m_tmp_value = std::move(losses);
+    return loss;
+}
+
+template <typename T>
+template <char OP>
+void Value<T>::_backward_kernel(Value<T> *const *values, size_t n) {
+    // OP is known at compile time, so every kernel is a tight loop over
+    // values of the same op with no dispatch inside
+    for (size_t i = 0; i < n; i++) {
+        Value<T> *v = values[i];
+        const T grad = v->grad;
+        const auto &prev = v->m_prev;
+        const auto &operands = v->m_operands;
+
+        if constexpr (OP == ADD) {
+            // Should just move the gradient along to both of them
+            // += because we want to avoid bugs if we reuse a variable
+            prev[0]->grad += grad;
+            prev[1]->grad += grad;
+        } else if constexpr (OP == DIF) {
+            prev[0]->grad += grad;
+            prev[1]->grad += -grad;  // same as doing -=
+        } else if constexpr (OP == MUL) {
+            prev[0]->grad += prev[1]->data * grad;
+            prev[1]->grad += prev[0]->data * grad;
+        } else if constexpr (OP == DIV) {
+            // m_cache = 1 / b and data = a / b so -a / b^2 = -data / b
+            prev[0]->grad += v->m_cache * grad;
+            prev[1]->grad += -v->data * v->m_cache * grad;
+        } else if constexpr (OP == POW) {
+            // m_cache = b * a^(b - 1) computed in the forward
+            prev[0]->grad += v->m_cache * grad;
+        } else if constexpr (OP == INV) {
+            // d(1/x) = -1/x^2 = -data^2
+            prev[0]->grad += -v->data * v->data * grad;
+        } else if constexpr (OP == EXP) {
+            // e^x is e^x which I already saved in data
+            prev[0]->grad += v->data * grad;
+        } else if constexpr (OP == TANH) {
+            prev[0]->grad += (1.0 - v->data * v->data) * grad;
+        } else if constexpr (OP == RELU) {
+            prev[0]->grad += (v->data > 0.0) ? grad : T(0.0);
+        } else if constexpr (OP == LRELU) {
+            prev[0]->grad += (v->data > 0.0) ? grad : T(0.01 * grad);
+        } else if constexpr (OP == SWISH) {
+            // keep in mind that data = swish(x), m_cache = sigmoid(x)
+            // and f'(x) = f(x) + sigmoid(x)(1 - f(x))
+            prev[0]->grad +=
+                (v->data + v->m_cache * (1.0 - v->data)) * grad;
+        } else if constexpr (OP == SUM) {
+            for (auto *x : operands) {
+                x->grad += grad;
+            }
+        } else if constexpr (OP == MEAN) {
+            const T mean_grad = grad / operands.size();
+            for (auto *x : operands) {
+                x->grad += mean_grad;
+            }
+        } else if constexpr (OP == DOT) {
+            // first half is lhs and second half is rhs
+            const size_t half = operands.size() / 2;
+            for (size_t j = 0; j < half; j++) {
+                operands[j]->grad += operands[half + j]->data * grad;
+                operands[half + j]->grad += operands[j]->data * grad;
+            }
+        } else if constexpr (OP == MAX) {
+            prev[0]->grad += grad;
+        } else if constexpr (OP == LSE) {
+            // d lse / dx_i = softmax(x)_i
+            for (auto *x : operands) {
+                x->grad += math::exp(x->data - v->data) * grad;
+            }
+        } else if constexpr (OP == SOFTMAX) {
+            // data = e^(x_i - lse) where m_prev[1] is the lse node
+            prev[0]->grad += v->data * grad;
+            prev[1]->grad += -v->data * grad;
+        } else if constexpr (OP == XENT) {
+            // data = lse - x_target so lse = data + x_target
+            const T lse = v->data + prev[0]->data;
+            for (auto *x : operands) {
+                x->grad += math::exp(x->data - lse) * grad;
+            }
+            prev[0]->grad += -grad;
+        } else if constexpr (OP == HINGE) {
+            const size_t half = operands.size() / 2;
+            for (size_t j = 0; j < half; j++) {
+                const T y = operands[half + j]->data;
+                if (1.0 - y * operands[j]->data > 0.0) {
+                    operands[j]->grad += -y / half * grad;
+                }
+            }
+        } else if constexpr (OP == MSE) {
+            const size_t half = operands.size() / 2;
+            for (size_t j = 0; j < half; j++) {
+                operands[j]->grad +=
+                    2.0 * (operands[j]->data - operands[half + j]->data) /
+                    half * grad;
+            }
+        } else if constexpr (OP == BCE) {
+            // d/dx = sigmoid(x) - y
+            const size_t half = operands.size() / 2;
+            for (size_t j = 0; j < half; j++) {
+                const T sigmoid = 1.0 / (1.0 + math::exp(-operands[j]->data));
+                operands[j]->grad +=
+                    (sigmoid - operands[half + j]->data) / half * grad;
+            }
+        } else if constexpr (OP == FUSED) {
+            v->m_fused->backward(grad);
+        }
+    }
+}
+
+template <typename T>
+const std::array<typename Value<T>::Kernel, 256> &Value<T>::_kernels() {
+    // Built once, the ops without a kernel (the leaves) do nothing
+    static const std::array<Kernel, 256> kernels = [] {
+        std::array<Kernel, 256> table;
+        table.fill(&_backward_kernel<' '>);
+        table[uint8_t(ADD)] = &_backward_kernel<ADD>;
+        table[uint8_t(DIF)] = &_backward_kernel<DIF>;
+        table[uint8_t(MUL)] = &_backward_kernel<MUL>;
+        table[uint8_t(DIV)] = &_backward_kernel<DIV>;
+        table[uint8_t(POW)] = &_backward_kernel<POW>;
+        table[uint8_t(INV)] = &_backward_kernel<INV>;
+        table[uint8_t(EXP)] = &_backward_kernel<EXP>;
+        table[uint8_t(TANH)] = &_backward_kernel<TANH>;
+        table[uint8_t(RELU)] = &_backward_kernel<RELU>;
+        table[uint8_t(LRELU)] = &_backward_kernel<LRELU>;
+        table[uint8_t(SWISH)] = &_backward_kernel<SWISH>;
+        table[uint8_t(SUM)] = &_backward_kernel<SUM>;
+        table[uint8_t(MEAN)] = &_backward_kernel<MEAN>;
+        table[uint8_t(DOT)] = &_backward_kernel<DOT>;
+        table[uint8_t(MAX)] = &_backward_kernel<MAX>;
+        table[uint8_t(LSE)] = &_backward_kernel<LSE>;
+        table[uint8_t(SOFTMAX)] = &_backward_kernel<SOFTMAX>;
+        table[uint8_t(XENT)] = &_backward_kernel<XENT>;
+        table[uint8_t(HINGE)] = &_backward_kernel<HINGE>;
+        table[uint8_t(MSE)] = &_backward_kernel<MSE>;
+        table[uint8_t(BCE)] = &_backward_kernel<BCE>;
+        table[uint8_t(FUSED)] = &_backward_kernel<FUSED>;
+        return table;
+    }();
+    return kernels;
 }
 
 template <typename T> void Value<T>::_backward_single() {
-    switch (this->m_op) {
+    Value<T> *self = this;
+    _kernels()[uint8_t(m_op)](&self, 1);
+}
+
+template <typename T> void Value<T>::_forward_single() {
+    // Same formulas as the ops that built the value
+    const size_t half = m_operands.size() / 2;
+    switch (m_op) {
     case ADD:
-        // Should just move the gradient along to both of them
-        // += because we want to avoid bugs if we reuse a variable
-        m_prev[0]->grad += grad;
-        m_prev[1]->grad += grad;
+        data = m_prev[0]->data + m_prev[1]->data;
         break;
     case DIF:
-        // same as m_prev[0] += 1.0 * grad;
-        m_prev[0]->grad += grad;
-        m_prev[1]->grad += -grad; // same as doing -=
+        data = m_prev[0]->data - m_prev[1]->data;
         break;
     case MUL:
-        // same as m_prev[0] += m_prev[1]->data * grad
-        m_prev[0]->grad += m_prev[1]->data * grad;
-        m_prev[1]->grad += m_prev[0]->data * grad;
+        data = m_prev[0]->data * m_prev[1]->data;
         break;
     case DIV:
-        m_prev[0]->grad += (1.0 / (m_prev[1]->data)) * grad;
-        m_prev[1]->grad +=
-            -(m_prev[0]->data) / std::pow(m_prev[1]->data, 2.0) * grad;
+        m_cache = 1.0 / m_prev[1]->data;
+        data = m_prev[0]->data * m_cache;
         break;
-    case POW:
-        m_prev[0]->grad +=
-            (m_prev[1]->data *
-             std::pow(m_prev[0]->data, (m_prev[1]->data - 1.0))) *
-            grad;
-        /* m_prev[0]->grad += (m_prev[1] * */
-        /* std::pow(m_prev[0]->data, (m_prev[1]->data - 1.0))) * grad; */
+    case POW: {
+        const T a = m_prev[0]->data, b = m_prev[1]->data;
+        data = math::pow(a, b);
+        m_cache = a != 0.0 ? b * data / a : b * math::pow(a, b - 1.0);
         break;
+    }
     case INV:
-        // e^x is e^x which I already saved in data
-        m_prev[0]->grad += (-1.0 / std::pow(m_prev[0]->data, 2.0)) * grad;
+        data = 1.0 / m_prev[0]->data;
         break;
     case EXP:
-        // e^x is e^x which I already saved in data
-        m_prev[0]->grad += data * grad;
+        data = math::exp(m_prev[0]->data);
         break;
     case TANH:
-        m_prev[0]->grad += (1.0 - std::pow(data, 2.0)) * grad;
+        data = math::tanh(m_prev[0]->data);
         break;
     case RELU:
-        m_prev[0]->grad += (data > 0.0) ? (1.0 * grad) : 0.0;
+        data = m_prev[0]->data < 0.0 ? T(0.0) : m_prev[0]->data;
         break;
     case LRELU:
-        m_prev[0]->grad += (data > 0.0) ? grad : 0.01 * grad;
+        data = m_prev[0]->data > 0.0 ? m_prev[0]->data
+                                     : T(0.01 * m_prev[0]->data);
         break;
     case SWISH:
-        // keep in mind that data = swish(m_prev[0]->data)
-        // and f'(x) = f(x) + sigmoid(x)(1 + f(x))
-        m_prev[0]->grad +=
-            (data + (1.0 / (1.0 + std::exp(-m_prev[0]->data))) * (1.0 + data)) *
-            grad;
+        m_cache = 1.0 / (1.0 + math::exp(-m_prev[0]->data));
+        data = m_prev[0]->data * m_cache;
+        break;
+    case SUM:
+    case MEAN:
+        data = 0.0;
+        for (auto *v : m_operands) {
+            data += v->data;
+        }
+        if (m_op == MEAN) {
+            data = data / m_operands.size();
+        }
+        break;
+    case DOT:
+        data = 0.0;
+        for (size_t i = 0; i < half; i++) {
+            data += m_operands[i]->data * m_operands[half + i]->data;
+        }
+        break;
+    case MAX:
+        // The max may now be another operand
+        m_prev[0] = m_operands[0];
+        for (auto *v : m_operands) {
+            if (v->data > m_prev[0]->data) {
+                m_prev[0] = v;
+            }
+        }
+        data = m_prev[0]->data;
+        break;
+    case LSE:
+    case XENT: {
+        T max = m_operands[0]->data;
+        for (auto *v : m_operands) {
+            max = std::max(max, v->data);
+        }
+        T sum = 0.0;
+        for (auto *v : m_operands) {
+            sum += math::exp(v->data - max);
+        }
+        data = max + math::log(sum);
+        // m_prev[0] is the target of the cross entropy
+        if (m_op == XENT) {
+            data = data - m_prev[0]->data;
+        }
+        break;
+    }
+    case SOFTMAX:
+        data = math::exp(m_prev[0]->data - m_prev[1]->data);
+        break;
+    case HINGE:
+    case MSE:
+    case BCE:
+        data = 0.0;
+        for (size_t i = 0; i < half; i++) {
+            const T x = m_operands[i]->data, y = m_operands[half + i]->data;
+            if (m_op == HINGE) {
+                data += std::max(T(0.0), T(1.0) - y * x);
+            } else if (m_op == MSE) {
+                data += (x - y) * (x - y);
+            } else {
+                data += std::max(x, T(0.0)) - y * x +
+                        math::log(1.0 + math::exp(-math::abs(x)));
+            }
+        }
+        data = data / half;
+        break;
+    case FUSED:
+        data = m_fused->forward();
         break;
     default:
+        // Leaves keep their data
         break;
     }
 }
 
-template <typename T> void Value<T>::_topo_sort(Value<T> *v) {
-    // Add it to the visited values
-    m_visited.insert(v);
+template <typename T> void Value<T>::_schedule() {
+    // Iterative topological sort of the values with children, the kernel of
+    // the leaves does nothing. Stack of values with the index of the next
+    // child to visit, the children are m_prev followed by m_operands. The
+    // values found are marked with m_order instead of a set: 1 until they are
+    // sorted, then their position + 1
+    std::vector<Value<T> *> sorted;
+    std::vector<std::pair<Value<T> *, size_t>> stack = {{this, 0}};
+    m_order = 1;
+    while (!stack.empty()) {
+        auto &[v, next] = stack.back();
+        const size_t num_children = 2 + v->m_operands.size();
 
-    // Iterate trough the children
-    for (auto *child : v->m_prev) {
-        // If not visited and not a leaf value
-        if (m_visited.count(child) == 0 && child != nullptr) {
-            // Call the function recursively
-            _topo_sort(child);
+        Value<T> *child = nullptr;
+        while (next < num_children && child == nullptr) {
+            Value<T> *candidate =
+                next < 2 ? v->m_prev[next] : v->m_operands[next - 2];
+            next++;
+            if (candidate != nullptr && candidate->m_op != ' ' &&
+                candidate->m_order == 0) {
+                child = candidate;
+            }
+        }
+
+        if (child != nullptr) {
+            child->m_order = 1;
+            stack.emplace_back(child, 0);
+        } else {
+            sorted.push_back(v);
+            v->m_order = uint32_t(sorted.size());
+            stack.pop_back();
+        }
+    }
+
+    // The level of a value is its longest distance from the root: all the
+    // values using it have a lower level, so the values of the same level do
+    // not depend on each other and can be run in any order
+    const size_t n = sorted.size();
+    std::vector<size_t> levels(n, 0);
+    size_t num_levels = 1;
+    for (size_t i = n; i-- > 0;) {
+        const size_t level = levels[i] + 1;
+        auto lower = [&](Value<T> *child) {
+            if (child != nullptr && child->m_op != ' ') {
+                size_t &child_level = levels[child->m_order - 1];
+                child_level = std::max(child_level, level);
+                num_levels = std::max(num_levels, level + 1);
+            }
+        };
+        for (auto *child : sorted[i]->m_prev) {
+            lower(child);
+        }
+        for (auto *child : sorted[i]->m_operands) {
+            lower(child);
         }
     }
-    m_sorted_values.push_back(v);
+    for (auto *v : sorted) {
+        v->m_order = 0;
+    }
+
+    // Group the values by level and then by op without sorting: a counting
+    // sort on the op followed by a stable one on the level
+    std::vector<size_t> by_op(n), by_level(n);
+    std::array<size_t, 257> op_begin = {};
+    for (auto *v : sorted) {
+        op_begin[uint8_t(v->m_op) + 1]++;
+    }
+    for (size_t op = 1; op < op_begin.size(); op++) {
+        op_begin[op] += op_begin[op - 1];
+    }
+    for (size_t i = 0; i < n; i++) {
+        by_op[op_begin[uint8_t(sorted[i]->m_op)]++] = i;
+    }
+    std::vector<size_t> level_begin(num_levels + 1, 0);
+    for (size_t i = 0; i < n; i++) {
+        level_begin[levels[i] + 1]++;
+    }
+    for (size_t level = 1; level < level_begin.size(); level++) {
+        level_begin[level] += level_begin[level - 1];
+    }
+    for (size_t i : by_op) {
+        by_level[level_begin[levels[i]]++] = i;
+    }
+
+    // End of every run of values with the same level and op
+    auto schedule = std::make_shared<_Schedule<T>>();
+    schedule->sorted_values.reserve(n);
+    for (size_t k = 0; k < n; k++) {
+        const size_t i = by_level[k];
+        schedule->sorted_values.push_back(sorted[i]);
+        if (k + 1 == n || levels[by_level[k + 1]] != levels[i] ||
+            sorted[by_level[k + 1]]->m_op != sorted[i]->m_op) {
+            schedule->runs.push_back(k + 1);
+        }
+    }
+    m_schedule = std::move(schedule);
 }
 
 template <typename T> void Value<T>::backward() {
-    // If empty do topo sort
-    if (m_sorted_values.empty()) {
-        _topo_sort(this);
+    // If not scheduled yet do topo sort and group the values
+    if (!m_schedule) {
+        _schedule();
     }
 
     // Set the derivative of dx/dx to 1
     this->grad = 1.0;
 
-    // Call backward in topological order applying the chain rule automatically
-    for (auto it = m_sorted_values.rbegin(); it != m_sorted_values.rend();
-         ++it) {
-        (*it)->_backward_single();
+    // Run every group of values through the kernel of its op, level by level
+    // starting from the root
+    const auto &kernels = _kernels();
+    const auto &sorted_values = m_schedule->sorted_values;
+    size_t begin = 0;
+    for (size_t end : m_schedule->runs) {
+        kernels[uint8_t(sorted_values[begin]->m_op)](&sorted_values[begin],
+                                                     end - begin);
+        begin = end;
     }
 }
 
 template <typename T> void Value<T>::draw_graph() {
-    // Perform a topological sort of the graph in reverse
-    if (m_sorted_values.empty()) {
-        _topo_sort(this);
+    // Every value of the graph, the leaves too
+    std::vector<Value<T> *> values_of_graph = {this};
+    std::unordered_set<Value<T> *> visited = {this};
+    for (size_t i = 0; i < values_of_graph.size(); i++) {
+        Value<T> *v = values_of_graph[i];
+        for (auto *child : v->m_prev) {
+            if (child != nullptr && visited.insert(child).second) {
+                values_of_graph.push_back(child);
+            }
+        }
+        for (auto *child : v->m_operands) {
+            if (visited.insert(child).second) {
+                values_of_graph.push_back(child);
+            }
+        }
     }
 
     // Open a file to write the output
@@ -272,7 +1104,7 @@ template <typename T> void Value<T>::draw_graph() {
     // Create a graphviz graph
     outfile << "digraph G {\n";
     outfile << "  rankdir=LR; // set rankdir attribute to LR\n";
-    for (const auto &values : m_sorted_values) {
+    for (const auto &values : values_of_graph) {
         outfile << "  " << uintptr_t(values)
                 << " [label=\"label = " << values->label
                 << " | data = " << values->data << " | grad = " << values->grad
@@ -292,6 +1124,12 @@ template <typename T> void Value<T>::draw_graph() {
                 outfile << "  " << uintptr_t(values->m_prev[j]) << " -> "
                         << uintptr_t(values) + values->m_op << "\n";
             }
+        for (auto *operand : values->m_operands) {
+            if (operand != values->m_prev[0]) {
+                outfile << "  " << uintptr_t(operand) << " -> "
+                        << uintptr_t(values) + values->m_op << "\n";
+            }
+        }
     }
 
     outfile << "}\n";
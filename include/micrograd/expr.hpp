@@ -0,0 +1,316 @@
+//  expr.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "engine.hpp"
+#include <type_traits>
+
+// Opt-in expression templates: an arithmetic expression over leaves is
+// captured in its type at compile time and becomes a single FUSED value whose
+// forward and backward are generated by the compiler, instead of one value
+// (and one switch in the backward) for every operator.
+//
+//     auto n = fuse([](auto x1, auto w1, auto x2, auto w2, auto b) {
+//         return x1 * w1 + x2 * w2 + b;
+//     }, x1, w1, x2, w2, b);
+//
+// Every expression node caches its value during the forward, so the backward
+// only multiplies the local derivatives along the tree
+namespace value_engine::expr {
+
+// ==================== Leaves =====================
+
+// A Value of the graph, the gradient flows back to it
+template <typename T> struct Leaf {
+    using value_type = T;
+    static constexpr bool is_constant = false;
+
+    Value<T> *value;
+    T data;
+
+    T forward() { return data = value->data; }
+    void backward(T grad) { value->grad += grad; }
+    void collect(std::vector<Value<T> *> &leaves) const {
+        leaves.push_back(value);
+    }
+};
+
+// A constant, it has no gradient
+template <typename T> struct Const {
+    using value_type = T;
+    static constexpr bool is_constant = true;
+
+    T data;
+
+    T forward() { return data; }
+    void backward(T) {}
+    void collect(std::vector<Value<T> *> &) const {}
+};
+
+template <typename E> struct is_expr : std::false_type {};
+template <typename T> struct is_expr<Leaf<T>> : std::true_type {};
+template <typename T> struct is_expr<Const<T>> : std::true_type {};
+
+// ==================== Nodes =====================
+
+template <typename Op, typename L, typename R> struct Binary {
+    using value_type = typename L::value_type;
+    static constexpr bool is_constant = false;
+
+    L lhs;
+    R rhs;
+    value_type data;
+
+    value_type forward() {
+        return data = Op::forward(lhs.forward(), rhs.forward());
+    }
+    void backward(value_type grad) { Op::backward(lhs, rhs, data, grad); }
+    void collect(std::vector<Value<value_type> *> &leaves) const {
+        lhs.collect(leaves);
+        rhs.collect(leaves);
+    }
+};
+
+template <typename Op, typename A> struct Unary {
+    using value_type = typename A::value_type;
+    static constexpr bool is_constant = false;
+
+    A arg;
+    value_type data;
+
+    value_type forward() { return data = Op::forward(arg.forward()); }
+    void backward(value_type grad) {
+        arg.backward(Op::derivative(arg.data, data) * grad);
+    }
+    void collect(std::vector<Value<value_type> *> &leaves) const {
+        arg.collect(leaves);
+    }
+};
+
+template <typename Op, typename L, typename R>
+struct is_expr<Binary<Op, L, R>> : std::true_type {};
+template <typename Op, typename A>
+struct is_expr<Unary<Op, A>> : std::true_type {};
+
+template <typename E>
+concept Expression = is_expr<std::remove_cvref_t<E>>::value;
+
+// ==================== Ops =====================
+// Same ops and local derivatives as Value::_backward_single
+
+struct Add {
+    template <typename T> static T forward(T a, T b) { return a + b; }
+    template <typename L, typename R, typename T>
+    static void backward(L &lhs, R &rhs, T, T grad) {
+        lhs.backward(grad);
+        rhs.backward(grad);
+    }
+};
+
+struct Dif {
+    template <typename T> static T forward(T a, T b) { return a - b; }
+    template <typename L, typename R, typename T>
+    static void backward(L &lhs, R &rhs, T, T grad) {
+        lhs.backward(grad);
+        rhs.backward(-grad);
+    }
+};
+
+struct Mul {
+    template <typename T> static T forward(T a, T b) { return a * b; }
+    template <typename L, typename R, typename T>
+    static void backward(L &lhs, R &rhs, T, T grad) {
+        lhs.backward(rhs.data * grad);
+        rhs.backward(lhs.data * grad);
+    }
+};
+
+struct Div {
+    template <typename T> static T forward(T a, T b) { return a / b; }
+    template <typename L, typename R, typename T>
+    static void backward(L &lhs, R &rhs, T data, T grad) {
+        const T inv = 1.0 / rhs.data;
+        lhs.backward(inv * grad);
+        rhs.backward(-data * inv * grad);
+    }
+};
+
+struct Pow {
+    template <typename T> static T forward(T a, T b) {
+        return math::pow(a, b);
+    }
+    template <typename L, typename R, typename T>
+    static void backward(L &lhs, R &rhs, T data, T grad) {
+        lhs.backward(rhs.data * math::pow(lhs.data, rhs.data - 1.0) * grad);
+        // The log is only needed when the exponent is not a constant
+        if constexpr (!R::is_constant) {
+            rhs.backward(data * math::log(lhs.data) * grad);
+        }
+    }
+};
+
+struct Inv {
+    template <typename T> static T forward(T x) { return 1.0 / x; }
+    template <typename T> static T derivative(T, T data) {
+        return -data * data;
+    }
+};
+
+struct Exp {
+    template <typename T> static T forward(T x) { return math::exp(x); }
+    template <typename T> static T derivative(T, T data) { return data; }
+};
+
+struct Tanh {
+    template <typename T> static T forward(T x) { return math::tanh(x); }
+    template <typename T> static T derivative(T, T data) {
+        return 1.0 - data * data;
+    }
+};
+
+struct Relu {
+    template <typename T> static T forward(T x) { return x < 0.0 ? T(0.0) : x; }
+    template <typename T> static T derivative(T, T data) {
+        return data > 0.0 ? T(1.0) : T(0.0);
+    }
+};
+
+struct Lrelu {
+    template <typename T> static T forward(T x) {
+        return x > 0.0 ? x : T(0.01 * x);
+    }
+    template <typename T> static T derivative(T, T data) {
+        return data > 0.0 ? T(1.0) : T(0.01);
+    }
+};
+
+struct Swish {
+    template <typename T> static T forward(T x) {
+        return x / (1.0 + math::exp(-x));
+    }
+    // f'(x) = f(x) + sigmoid(x)(1 - f(x))
+    template <typename T> static T derivative(T x, T data) {
+        const T sigmoid = 1.0 / (1.0 + math::exp(-x));
+        return data + sigmoid * (1.0 - data);
+    }
+};
+
+// ==================== Operators =====================
+
+// Turn scalars into constants, expressions are left as they are
+template <typename T, typename E> auto _lift(E &&e) {
+    if constexpr (Expression<E>) {
+        return std::forward<E>(e);
+    } else {
+        return Const<T>{T(e)};
+    }
+}
+
+// Value type of the expression among lhs and rhs
+template <typename L, typename R>
+using _value_type =
+    typename std::conditional_t<Expression<L>, std::remove_cvref_t<L>,
+                                std::remove_cvref_t<R>>::value_type;
+
+template <typename Op, typename L, typename R> auto _binary(L &&lhs, R &&rhs) {
+    using T = _value_type<L, R>;
+    auto l = _lift<T>(std::forward<L>(lhs));
+    auto r = _lift<T>(std::forward<R>(rhs));
+    return Binary<Op, decltype(l), decltype(r)>{l, r, T(0.0)};
+}
+
+template <typename L, typename R>
+    requires(Expression<L> || Expression<R>)
+auto operator+(L &&lhs, R &&rhs) {
+    return _binary<Add>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <typename L, typename R>
+    requires(Expression<L> || Expression<R>)
+auto operator-(L &&lhs, R &&rhs) {
+    return _binary<Dif>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <typename L, typename R>
+    requires(Expression<L> || Expression<R>)
+auto operator*(L &&lhs, R &&rhs) {
+    return _binary<Mul>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <typename L, typename R>
+    requires(Expression<L> || Expression<R>)
+auto operator/(L &&lhs, R &&rhs) {
+    return _binary<Div>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <typename L, typename R>
+    requires(Expression<L> || Expression<R>)
+auto operator^(L &&lhs, R &&rhs) {
+    return _binary<Pow>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <Expression E> auto operator-(E &&e) {
+    return _binary<Dif>(0.0, std::forward<E>(e));
+}
+
+template <typename Op, Expression E> auto _unary(E &&e) {
+    using A = std::remove_cvref_t<E>;
+    return Unary<Op, A>{std::forward<E>(e), typename A::value_type(0.0)};
+}
+
+template <Expression E> auto inverse_value(E &&e) {
+    return _unary<Inv>(std::forward<E>(e));
+}
+template <Expression E> auto exp_value(E &&e) {
+    return _unary<Exp>(std::forward<E>(e));
+}
+template <Expression E> auto tanh(E &&e) {
+    return _unary<Tanh>(std::forward<E>(e));
+}
+template <Expression E> auto relu(E &&e) {
+    return _unary<Relu>(std::forward<E>(e));
+}
+template <Expression E> auto lrelu(E &&e) {
+    return _unary<Lrelu>(std::forward<E>(e));
+}
+template <Expression E> auto swish(E &&e) {
+    return _unary<Swish>(std::forward<E>(e));
+}
+
+// ==================== Fusion =====================
+
+template <typename T, typename E> class FusedNode : public FusedExpr<T> {
+ public:
+    explicit FusedNode(E expr) : m_expr(std::move(expr)) {}
+
+    T forward() override { return m_expr.forward(); }
+    void backward(T grad) override { m_expr.backward(grad); }
+
+ protected:
+    E m_expr;
+};
+
+template <typename T> Leaf<T> leaf(Value<T> &v) { return Leaf<T>{&v, v.data}; }
+
+// Single value computed by the whole expression
+template <Expression E> auto fuse(E &&e) {
+    using T = typename std::remove_cvref_t<E>::value_type;
+    std::vector<Value<T> *> leaves;
+    e.collect(leaves);
+    return Value<T>(
+        std::make_shared<FusedNode<T, std::remove_cvref_t<E>>>(
+            std::forward<E>(e)),
+        std::move(leaves));
+}
+
+// Single value computed by f on the given values, f gets a leaf for each of
+// them and returns the expression
+template <typename F, typename T, typename... Vs>
+auto fuse(F &&f, Value<T> &v, Vs &...vs) {
+    return fuse(f(leaf(v), leaf(vs)...));
+}
+}  // namespace value_engine::expr
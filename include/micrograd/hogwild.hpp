@@ -0,0 +1,131 @@
+//  hogwild.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "nn.hpp"
+#include <atomic>
+#include <functional>
+#include <thread>
+
+// Lock free asynchronous SGD (Hogwild): every thread trains its own replica of
+// the model on a different shard of the samples and applies its updates
+// directly to the parameters of the shared model with relaxed atomics.
+// Updates of different threads may overwrite each other, which is fine for
+// small and sparse gradients
+template <typename T, size_t N> class HogwildTrainer {
+public:
+    // Loss of a single sample: loss(output, target)
+    using Loss = std::function<Value<T>(const Value_Vec<T> &,
+                                        const Value_Vec<T> &)>;
+
+    HogwildTrainer(MLP<T, N> &model, size_t num_threads,
+                   T weight_decay = 0.0);
+
+    // Train the shared model for the given number of epochs, the learning
+    // rate is a function of the epoch. Returns the mean loss of the last epoch
+    T train(const std::vector<Value_Vec<T>> &inputs,
+            const Value_Vec<T> &targets, size_t epochs,
+            std::function<T(size_t)> learning_rate, Loss loss);
+
+public:
+    T weight_decay;
+
+protected:
+    // Run by every thread on the samples i = thread_id + k * num_threads,
+    // the replica is the thread's own copy of the model
+    T _worker(size_t thread_id, MLP<T, N> &replica,
+              const std::vector<Value_Vec<T>> &inputs,
+              const Value_Vec<T> &targets, size_t epochs,
+              const std::function<T(size_t)> &learning_rate,
+              const Loss &loss);
+
+protected:
+    MLP<T, N> &m_model;
+    size_t m_num_threads;
+    // Parameters of the shared model, the storage every thread updates
+    std::vector<Value<T> *> m_parameters;
+};
+
+//  ================ Implementation HogwildTrainer =================
+
+template <typename T, size_t N>
+HogwildTrainer<T, N>::HogwildTrainer(MLP<T, N> &model, size_t num_threads,
+                                     T weight_decay)
+    : weight_decay(weight_decay), m_model(model),
+      m_num_threads(std::max(num_threads, size_t(1))),
+      m_parameters(model.parameters()) {}
+
+template <typename T, size_t N>
+T HogwildTrainer<T, N>::train(const std::vector<Value_Vec<T>> &inputs,
+                              const Value_Vec<T> &targets, size_t epochs,
+                              std::function<T(size_t)> learning_rate,
+                              Loss loss) {
+    std::vector<T> losses(m_num_threads, T(0.0));
+    // Every thread has its own graph, only the parameters are shared. The
+    // replicas are copied before any thread starts writing the parameters
+    std::vector<MLP<T, N>> replicas(m_num_threads, m_model);
+    std::vector<std::thread> threads;
+
+    for (size_t t = 0; t < m_num_threads; t++) {
+        threads.emplace_back([&, t]() {
+            losses[t] = _worker(t, replicas[t], inputs, targets, epochs,
+                                learning_rate, loss);
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    T total = 0.0;
+    for (auto &l : losses) {
+        total += l;
+    }
+    return total / inputs.size();
+}
+
+template <typename T, size_t N>
+T HogwildTrainer<T, N>::_worker(size_t thread_id, MLP<T, N> &replica,
+                                const std::vector<Value_Vec<T>> &inputs,
+                                const Value_Vec<T> &targets, size_t epochs,
+                                const std::function<T(size_t)> &learning_rate,
+                                const Loss &loss) {
+    replica.zero_grad();
+    std::vector<Value<T> *> local = replica.parameters();
+
+    T epoch_loss = 0.0;
+    for (size_t epoch = 0; epoch < epochs; epoch++) {
+        const T lr = learning_rate(epoch);
+        epoch_loss = 0.0;
+
+        for (size_t i = thread_id; i < inputs.size(); i += m_num_threads) {
+            // Read the current shared parameters
+            for (size_t p = 0; p < local.size(); p++) {
+                local[p]->data = std::atomic_ref<T>(m_parameters[p]->data)
+                                     .load(std::memory_order_relaxed);
+            }
+
+            GraphScope<T> scope;
+            replica.zero_grad();
+            Value_Vec<T> output = replica(inputs[i]);
+            Value_Vec<T> target = {targets[i]};
+            auto sample_loss = loss(output, target);
+            sample_loss.backward();
+            epoch_loss += sample_loss.data;
+
+            // Apply the update straight to the shared parameters, without
+            // any lock: a concurrent update may be lost
+            for (size_t p = 0; p < local.size(); p++) {
+                std::atomic_ref<T> shared(m_parameters[p]->data);
+                const T data = shared.load(std::memory_order_relaxed);
+                shared.store(data - lr * (local[p]->grad +
+                                          weight_decay * local[p]->data),
+                             std::memory_order_relaxed);
+            }
+        }
+    }
+    return epoch_loss;
+}
@@ -6,20 +6,88 @@
 
 #pragma once
 
+#include "dual.hpp"
 #include "engine.hpp"
-#include <random>
+#include "random.hpp"
+#include <type_traits>
 /* #include <variant> */
 
 using namespace value_engine;
 
-template <typename T> T random_uniform(T range_from, T range_to) {
-    std::random_device rand_dev;
-    std::mt19937 generator(rand_dev());
-    std::uniform_real_distribution<T> distr(range_from, range_to);
-    return distr(generator);
+// ---------------------------------------------------------
+
+// Activation of a layer, all its neurons share it
+enum class activation : char { linear, relu, lrelu, tanh, swish };
+
+// One policy for every activation, each one works on T, Dual and on Value
+// (which needs an lvalue since the result points to it)
+namespace activations {
+struct Linear {
+    template <typename V> static V apply(V &x) { return x; }
+};
+
+struct Relu {
+    template <typename V> static V apply(V &x) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return x < 0.0 ? V(0.0) : x;
+        } else {
+            return x.relu();
+        }
+    }
+};
+
+struct Lrelu {
+    template <typename V> static V apply(V &x) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return x > 0.0 ? x : V(0.01) * x;
+        } else {
+            return x.lrelu();
+        }
+    }
+};
+
+struct Tanh {
+    template <typename V> static V apply(V &x) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return std::tanh(x);
+        } else {
+            return x.tanh();
+        }
+    }
+};
+
+struct Swish {
+    template <typename V> static V apply(V &x) {
+        if constexpr (std::is_arithmetic_v<V>) {
+            return x / (V(1.0) + std::exp(-x));
+        } else {
+            return x.swish();
+        }
+    }
+};
+} // namespace activations
+
+// Resolve the activation once and call f with its policy, so that whatever
+// loop f runs is compiled for that activation without a branch inside
+template <typename F> decltype(auto) with_activation(activation act, F &&f) {
+    switch (act) {
+    case activation::relu:
+        return f(activations::Relu{});
+    case activation::lrelu:
+        return f(activations::Lrelu{});
+    case activation::tanh:
+        return f(activations::Tanh{});
+    case activation::swish:
+        return f(activations::Swish{});
+    default:
+        return f(activations::Linear{});
+    }
 }
 
-// ---------------------------------------------------------
+// The old bool nonlin: lrelu or nothing
+inline activation _activation(bool nonlin) {
+    return nonlin ? activation::lrelu : activation::linear;
+}
 
 // Module Parent class as an interface
 template <typename T> class Module {
@@ -28,34 +96,112 @@ public:
         for (auto &p : parameters()) {
             p->grad = 0.0;
         }
-        m_weighted_sums.clear();
-        m_layers_output.clear();
+        release_graph();
     }
     // Make it virtual so that it can be override
     virtual std::vector<Value<T> *> parameters() { return {}; }
+    // Free the intermediates kept without a GraphScope by this module and
+    // the ones it is made of, the graphs built on them can not be used after
+    virtual void release_graph() {
+        m_weighted_sums.clear();
+        m_layers_output.clear();
+        m_outputs_in_scope = false;
+    }
+
+protected:
+    // Keep the intermediates of the graph alive: in the current GraphScope,
+    // or in the module until zero_grad when there is none
+    Value<T> &_keep(Value<T> &&v) {
+        if (GraphScope<T> *scope = GraphScope<T>::current()) {
+            return *scope->make(std::move(v));
+        }
+        m_weighted_sums.push_back(std::make_shared<Value<T>>(std::move(v)));
+        return *m_weighted_sums.back();
+    }
+    Value_Vec<T> &_keep(Value_Vec<T> &&v) {
+        _drop_released_outputs();
+        if (GraphScope<T> *scope = GraphScope<T>::current()) {
+            // Owned by the scope, the pointer (with no owner) is only there
+            // for last_inputs
+            Value_Vec<T> *kept = scope->make(std::move(v));
+            m_layers_output.push_back(
+                Ptr_Value_Vec<T>(Ptr_Value_Vec<T>(), kept));
+            m_outputs_scope = scope->token();
+            m_outputs_in_scope = true;
+            return *kept;
+        }
+        m_layers_output.push_back(std::make_shared<Value_Vec<T>>(std::move(v)));
+        m_outputs_in_scope = false;
+        return *m_layers_output.back();
+    }
+    // The outputs kept in a GraphScope which has ended point to freed
+    // vectors, returns true if they were dropped
+    bool _drop_released_outputs() {
+        if (m_outputs_in_scope && m_outputs_scope.expired()) {
+            m_layers_output.clear();
+            m_outputs_in_scope = false;
+            return true;
+        }
+        return false;
+    }
 
 protected:
     Value_Vec_Ptr<T> m_weighted_sums;
     std::vector<Ptr_Value_Vec<T>> m_layers_output;
+    // Scope of the last outputs in m_layers_output if they are in one
+    std::weak_ptr<void> m_outputs_scope;
+    bool m_outputs_in_scope = false;
 };
 
 template <typename T> class Neuron : public Module<T> {
 public:
-    Neuron(size_t num_neurons_input, bool nonlin = true);
+    // Without a generator every neuron draws its weights from a stream of
+    // its own (Random::unique)
+    Neuron(size_t num_neurons_input, bool nonlin = true,
+           Random rng = Random::unique());
+    Neuron(size_t num_neurons_input, activation act,
+           Random rng = Random::unique());
+    // Neuron with the weights already initialized
+    Neuron(size_t num_neurons_input, activation act, const T *weights);
     virtual ~Neuron(){};
 
     // Call operator: w * x + b dot product
     Value<T> operator()(const Value_Vec<T> &x);
+    // Sparse input: only the weights of the non zero inputs are in the graph
+    Value<T> operator()(const Sparse_Vec<T> &x);
+    // Forward mode: same as above without building the graph
+    template <size_t K>
+    Dual<T, K> operator()(const std::vector<Dual<T, K>> &x) const;
+    template <size_t K> Dual<T, K> operator()(const Dual<T, K> *x) const;
+    // Inference only: reads the parameters and does not touch the graph, so
+    // it can be called from multiple threads at once
+    T predict(const T *x) const;
+    // w * x + b without the activation
+    T weighted_sum(const T *x) const;
 
     // Overriding
     virtual std::vector<Value<T> *> parameters() override;
+    // The bias and the weights used by the sparse call operator since the
+    // last zero_touched_grad, the only ones that can have a gradient
+    std::vector<Value<T> *> touched_parameters();
+    // zero_grad in time proportional to the touched parameters
+    void zero_touched_grad();
+
+    const std::vector<Value<T>> &weights() const { return m_weights; }
+    const Value<T> &bias() const { return m_bias; }
+    activation act() const { return m_activation; }
+    bool nonlin() const { return m_activation != activation::linear; }
 
 protected:
     size_t m_num_neurons_input;
-    bool m_nonlin;
+    activation m_activation;
     std::vector<Value<T>> m_weights;
     // I'm not propagating the gradient to the bias
     Value<T> m_bias;
+    // Indices of the touched weights and a flag for each weight to add them
+    // only once
+    std::vector<size_t> m_touched;
+    std::vector<bool> m_is_touched;
     using Module<T>::m_weighted_sums; // bring m_weighted_sums into the scope of
                                       // Neuron
 };
@@ -64,29 +210,77 @@ protected:
 
 template <typename T> class Layer : public Module<T> {
 public:
-    Layer(size_t num_neurons_input, size_t num_neurons_out, bool nonlin = true);
+    // Same as the neuron, without a generator every layer has its own stream
+    Layer(size_t num_neurons_input, size_t num_neurons_out, bool nonlin = true,
+          Random rng = Random::unique(), init_type init = UNIFORM);
+    Layer(size_t num_neurons_input, size_t num_neurons_out, activation act,
+          Random rng = Random::unique(), init_type init = UNIFORM);
     virtual ~Layer(){};
 
     // Call operator: forward for every neuron in the layer
     Value_Vec<T> operator()(const Value_Vec<T> &x);
+    Value_Vec<T> operator()(const Sparse_Vec<T> &x);
+    template <size_t K>
+    std::vector<Dual<T, K>> operator()(const std::vector<Dual<T, K>> &x) const;
+    // Forward mode into out, one Dual for each neuron, without allocating
+    template <size_t K>
+    void forward(const Dual<T, K> *x, Dual<T, K> *out) const;
+    // Inference only on a batch of samples, thread safe
+    std::vector<std::vector<T>>
+    predict(const std::vector<std::vector<T>> &xs) const;
 
     // Overriding
     virtual std::vector<Value<T> *> parameters() override;
+    virtual void release_graph() override;
+    std::vector<Value<T> *> touched_parameters();
+    void zero_touched_grad();
+
+    const std::vector<Neuron<T>> &neurons() const { return m_neurons; }
+    activation act() const { return m_activation; }
 
 protected:
     // Create the neurons for the layer
     std::vector<Neuron<T>> m_neurons;
+    activation m_activation;
 };
 
 // ----------------------------------------------------------
 
 template <typename T, size_t N> class MLP : public Module<T> {
 public:
-    MLP(size_t num_neurons_input, std::array<size_t, N> num_neurons_out);
+    // Every layer draws its weights from its own stream of rng. The hidden
+    // layers use lrelu and the last one is linear. The default generator is
+    // always the same, two models built with it start from the same weights
+    MLP(size_t num_neurons_input, std::array<size_t, N> num_neurons_out,
+        Random rng = Random(), init_type init = UNIFORM);
+    // Same with the activation of every layer
+    MLP(size_t num_neurons_input, std::array<size_t, N> num_neurons_out,
+        std::array<activation, N> activations, Random rng = Random(),
+        init_type init = UNIFORM);
     virtual ~MLP(){};
 
     // Call operator: w * x + b dot product
     Value_Vec<T> operator()(const Value_Vec<T> &x);
+    // Sparse input consumed directly by the first layer, the backward and
+    // the optimizer only have to touch the weights of the non zero inputs
+    Value_Vec<T> operator()(const Sparse_Vec<T> &x);
+    // Forward mode: the outputs carry the Jacobian vector products along the
+    // tangents of the inputs
+    template <size_t K>
+    std::vector<Dual<T, K>> operator()(const std::vector<Dual<T, K>> &x) const;
+    // Same with the outputs in out: the layers ping-pong between out and
+    // buffer, which only grow to the widest layer, so calling it again with
+    // the same vectors does not allocate
+    template <size_t K>
+    void forward(const std::vector<Dual<T, K>> &x,
+                 std::vector<Dual<T, K>> &out,
+                 std::vector<Dual<T, K>> &buffer) const;
+
+    // Inference only: unlike the call operator it does not store anything in
+    // the model, so one model can serve many threads at once
+    std::vector<T> predict(const std::vector<T> &x) const;
+    std::vector<std::vector<T>>
+    predict(const std::vector<std::vector<T>> &xs) const;
 
     // Declare the operator<< function as a friend function and get the
     // structure of the network
@@ -99,8 +293,20 @@ public:
         return os;
     }
 
+    size_t num_inputs() const { return m_num_neurons_in; }
+
     // Overriding
     virtual std::vector<Value<T> *> parameters() override;
+    virtual void release_graph() override;
+    // The touched parameters of the first layer and all the ones of the
+    // others, to be given to SGD::step(touched)
+    std::vector<Value<T> *> touched_parameters();
+    void zero_touched_grad();
+
+    // The copy of the inputs used by the last forward pass, this is where the
+    // gradients with respect to the inputs end up. It lives in the GraphScope
+    // of the forward pass, after the scope it throws std::logic_error
+    Value_Vec<T> &last_inputs();
 
 public:
     std::vector<Layer<T>> m_layers;
@@ -117,12 +323,30 @@ protected:
 //  ================ Implementation  Neuron =================
 
 template <typename T>
-Neuron<T>::Neuron(size_t number_of_neurons_input, bool nonlin)
-    : m_num_neurons_input(number_of_neurons_input), m_nonlin(nonlin),
-      /* m_bias(Value<T>(random_uniform(-1.0, 1.0), "bias")) { */
+Neuron<T>::Neuron(size_t number_of_neurons_input, bool nonlin, Random rng)
+    : Neuron(number_of_neurons_input, _activation(nonlin), rng) {}
+
+template <typename T>
+Neuron<T>::Neuron(size_t number_of_neurons_input, activation act, Random rng)
+    : m_num_neurons_input(number_of_neurons_input), m_activation(act),
+      m_bias(Value<T>(0.0, "bias")) {
+    std::vector<T> weights(m_num_neurons_input);
+    rng.fill_uniform(weights.data(), weights.size(), T(-1.0), T(1.0));
+
+    m_weights.reserve(m_num_neurons_input);
+    for (auto &w : weights) {
+        m_weights.emplace_back(Value<T>(w, "weight"));
+    }
+}
+
+template <typename T>
+Neuron<T>::Neuron(size_t number_of_neurons_input, activation act,
+                  const T *weights)
+    : m_num_neurons_input(number_of_neurons_input), m_activation(act),
       m_bias(Value<T>(0.0, "bias")) {
+    m_weights.reserve(m_num_neurons_input);
     for (size_t i = 0; i < m_num_neurons_input; i++) {
-        m_weights.emplace_back(Value<T>(random_uniform(-1.0, 1.0), "weight"));
+        m_weights.emplace_back(Value<T>(weights[i], "weight"));
     }
 }
 
@@ -130,26 +354,71 @@ Neuron<T>::Neuron(size_t number_of_neurons_input, bool nonlin)
 // values
 template <typename T> Value<T> Neuron<T>::operator()(const Value_Vec<T> &x) {
 
-    m_weighted_sums.push_back(std::make_shared<Value<T>>(0.0));
+    Value<T> &z = this->_keep(Value<T>(0.0));
 
     // Sum over all multiplies
     for (size_t i = 0; i < m_num_neurons_input; i++) {
-        // -> doesn't work and I do not know why
-        *m_weighted_sums.back() += m_weights[i] * x[i];
+        z += m_weights[i] * x[i];
     }
 
     // Add the bias
-    *m_weighted_sums.back() += m_bias;
+    z += m_bias;
 
     // return the activated value
-    /* return m_nonlin ? m_weighted_sums.back()->relu() :
-     * *m_weighted_sums.back(); */
-    return m_nonlin ? m_weighted_sums.back()->lrelu() : *m_weighted_sums.back();
-    /* return m_nonlin ? m_weighted_sums.back()->tanh() :
-     * *m_weighted_sums.back(); */
+    return with_activation(m_activation,
+                           [&z](auto act) { return act.apply(z); });
+}
+
+template <typename T> Value<T> Neuron<T>::operator()(const Sparse_Vec<T> &x) {
+    // Before marking the weights, a bad index must not write past the flags
+    _check_sparse(x, m_num_neurons_input);
+    m_is_touched.resize(m_num_neurons_input, false);
+    for (size_t i : x.indices) {
+        if (!m_is_touched[i]) {
+            m_is_touched[i] = true;
+            m_touched.push_back(i);
+        }
+    }
+
+    // Single dot node over the non zero inputs, then the bias
+    Value<T> &z = this->_keep(dot(m_weights, x));
+    Value<T> &z_bias = this->_keep(z + m_bias);
+
+    return with_activation(m_activation,
+                           [&z_bias](auto act) { return act.apply(z_bias); });
+}
+
+template <typename T>
+template <size_t K>
+Dual<T, K> Neuron<T>::operator()(const std::vector<Dual<T, K>> &x) const {
+    return (*this)(x.data());
+}
+
+template <typename T>
+template <size_t K>
+Dual<T, K> Neuron<T>::operator()(const Dual<T, K> *x) const {
+    Dual<T, K> weighted_sum(m_bias.data);
+    for (size_t i = 0; i < m_num_neurons_input; i++) {
+        weighted_sum += x[i] * m_weights[i].data;
+    }
+    return with_activation(m_activation, [&weighted_sum](auto act) {
+        return act.apply(weighted_sum);
+    });
+}
+
+template <typename T> T Neuron<T>::weighted_sum(const T *x) const {
+    T weighted_sum = m_bias.data;
+    for (size_t i = 0; i < m_num_neurons_input; i++) {
+        weighted_sum += m_weights[i].data * x[i];
+    }
+    return weighted_sum;
+}
 
-    /* return m_nonlin ? m_weighted_sums.back()->swish()
-     * :*m_weighted_sums.back(); */
+template <typename T> T Neuron<T>::predict(const T *x) const {
+    // Same activation as the call operator
+    T z = weighted_sum(x);
+    return with_activation(m_activation,
+                           [&z](auto act) { return act.apply(z); });
 }
 
 template <typename T> std::vector<Value<T> *> Neuron<T>::parameters() {
@@ -167,14 +436,48 @@ template <typename T> std::vector<Value<T> *> Neuron<T>::parameters() {
     return params;
 }
 
+template <typename T> std::vector<Value<T> *> Neuron<T>::touched_parameters() {
+    std::vector<Value<T> *> params;
+    params.reserve(m_touched.size() + 1);
+    params.push_back(&m_bias);
+    for (size_t i : m_touched) {
+        params.push_back(&m_weights[i]);
+    }
+    return params;
+}
+
+template <typename T> void Neuron<T>::zero_touched_grad() {
+    m_bias.grad = 0.0;
+    for (size_t i : m_touched) {
+        m_weights[i].grad = 0.0;
+        m_is_touched[i] = false;
+    }
+    m_touched.clear();
+    m_weighted_sums.clear();
+}
+
 //  ================ Implementation  Layer =================
 
 template <typename T>
 Layer<T>::Layer(size_t num_neurons_input, size_t num_neurons_output,
-                bool nonlin) {
+                bool nonlin, Random rng, init_type init)
+    : Layer(num_neurons_input, num_neurons_output, _activation(nonlin), rng,
+            init) {}
+
+template <typename T>
+Layer<T>::Layer(size_t num_neurons_input, size_t num_neurons_output,
+                activation act, Random rng, init_type init)
+    : m_activation(act) {
+    // Draw the weights of the whole layer at once
+    std::vector<T> weights(num_neurons_input * num_neurons_output);
+    rng.fill(weights.data(), weights.size(), num_neurons_input,
+             num_neurons_output, init);
+
     // Add all the neurons to the layer by crating them
+    m_neurons.reserve(num_neurons_output);
     for (size_t i = 0; i < num_neurons_output; i++) {
-        m_neurons.emplace_back(Neuron<T>(num_neurons_input, nonlin));
+        m_neurons.emplace_back(Neuron<T>(num_neurons_input, act,
+                                         &weights[i * num_neurons_input]));
     }
 }
 
@@ -190,6 +493,52 @@ template <typename T> Value_Vec<T> Layer<T>::operator()(const Value_Vec<T> &x) {
     return m_neurons_output;
 }
 
+template <typename T>
+Value_Vec<T> Layer<T>::operator()(const Sparse_Vec<T> &x) {
+    Value_Vec<T> neurons_output;
+    neurons_output.reserve(m_neurons.size());
+    for (auto &neuron : m_neurons) {
+        neurons_output.emplace_back(neuron(x));
+    }
+    return neurons_output;
+}
+
+template <typename T>
+template <size_t K>
+std::vector<Dual<T, K>>
+Layer<T>::operator()(const std::vector<Dual<T, K>> &x) const {
+    std::vector<Dual<T, K>> neurons_output(m_neurons.size());
+    forward(x.data(), neurons_output.data());
+    return neurons_output;
+}
+
+template <typename T>
+template <size_t K>
+void Layer<T>::forward(const Dual<T, K> *x, Dual<T, K> *out) const {
+    for (size_t j = 0; j < m_neurons.size(); j++) {
+        out[j] = m_neurons[j](x);
+    }
+}
+
+template <typename T>
+std::vector<std::vector<T>>
+Layer<T>::predict(const std::vector<std::vector<T>> &xs) const {
+    std::vector<std::vector<T>> outputs(xs.size(),
+                                        std::vector<T>(m_neurons.size()));
+    // The activation is picked once for the layer, the loops have no branch.
+    // Neurons in the outer loop so that the weights of a neuron are reused
+    // for the whole batch while they are in cache
+    with_activation(m_activation, [&](auto act) {
+        for (size_t j = 0; j < m_neurons.size(); j++) {
+            for (size_t b = 0; b < xs.size(); b++) {
+                T z = m_neurons[j].weighted_sum(xs[b].data());
+                outputs[b][j] = act.apply(z);
+            }
+        }
+    });
+    return outputs;
+}
+
 template <typename T> std::vector<Value<T> *> Layer<T>::parameters() {
     std::vector<Value<T> *> params;
     // Iterate over all the neurons
@@ -201,39 +550,166 @@ template <typename T> std::vector<Value<T> *> Layer<T>::parameters() {
     return params;
 }
 
+template <typename T> std::vector<Value<T> *> Layer<T>::touched_parameters() {
+    std::vector<Value<T> *> params;
+    for (auto &neuron : m_neurons) {
+        auto neuron_params = neuron.touched_parameters();
+        params.insert(params.end(), neuron_params.begin(), neuron_params.end());
+    }
+    return params;
+}
+
+template <typename T> void Layer<T>::release_graph() {
+    Module<T>::release_graph();
+    for (auto &neuron : m_neurons) {
+        neuron.release_graph();
+    }
+}
+
+template <typename T> void Layer<T>::zero_touched_grad() {
+    for (auto &neuron : m_neurons) {
+        neuron.zero_touched_grad();
+    }
+}
+
 //  ================ Implementation MLP =================
 
+// lrelu for the hidden layers and linear for the last one, the first layer
+// always has lrelu
+template <size_t N> std::array<activation, N> _default_activations() {
+    std::array<activation, N> activations;
+    for (size_t i = 0; i < N; i++) {
+        activations[i] =
+            (i == 0 || i != N - 1) ? activation::lrelu : activation::linear;
+    }
+    return activations;
+}
+
+template <typename T, size_t N>
+MLP<T, N>::MLP(size_t num_neurons_input,
+               std::array<size_t, N> num_neurons_output, Random rng,
+               init_type init)
+    : MLP(num_neurons_input, num_neurons_output, _default_activations<N>(),
+          rng, init) {}
+
 template <typename T, size_t N>
 MLP<T, N>::MLP(size_t num_neurons_input,
-               std::array<size_t, N> num_neurons_output)
+               std::array<size_t, N> num_neurons_output,
+               std::array<activation, N> activations, Random rng,
+               init_type init)
     : m_num_neurons_in(num_neurons_input),
       m_num_neurons_out(num_neurons_output) {
 
     // Create the first layer with the input neuron size
-    m_layers.emplace_back(Layer<T>(num_neurons_input, num_neurons_output[0]));
+    m_layers.emplace_back(Layer<T>(num_neurons_input, num_neurons_output[0],
+                                   activations[0], rng.split(0), init));
 
     // Create the following layers
     for (size_t i = 1; i < N; i++) {
         // Create layers N layers with the number of neuron from the previous
         // layers and output as the current
-        bool nonlin = (i != N - 1);
-        m_layers.emplace_back(
-            Layer<T>(num_neurons_output[i - 1], num_neurons_output[i], nonlin));
+        m_layers.emplace_back(Layer<T>(num_neurons_output[i - 1],
+                                       num_neurons_output[i], activations[i],
+                                       rng.split(i), init));
     }
 }
 
 template <typename T, size_t N>
 Value_Vec<T> MLP<T, N>::operator()(const Value_Vec<T> &x) {
 
-    m_layers_output.push_back(std::make_shared<Value_Vec<T>>(x));
+    Value_Vec<T> *output = &this->_keep(Value_Vec<T>(x));
 
     for (size_t i = 1; i <= N; i++) {
-        m_layers_output.emplace_back(std::make_shared<Value_Vec<T>>(
-            m_layers[i - 1](*m_layers_output.back())));
+        output = &this->_keep(m_layers[i - 1](*output));
     }
 
     // return the value of the last element which is a vector
-    return *(m_layers_output.back());
+    return *output;
+}
+
+template <typename T, size_t N>
+Value_Vec<T> MLP<T, N>::operator()(const Sparse_Vec<T> &x) {
+    // Keep a copy of the input as the dense call does, m_layers_output only
+    // points to its non zero values. The outputs of an ended scope are
+    // dropped first, dropping them after would free the input with them
+    this->_drop_released_outputs();
+    auto input = std::make_shared<Sparse_Vec<T>>(x);
+    m_layers_output.push_back(Ptr_Value_Vec<T>(input, &input->values));
+
+    Value_Vec<T> *output = &this->_keep(m_layers[0](*input));
+    for (size_t i = 2; i <= N; i++) {
+        output = &this->_keep(m_layers[i - 1](*output));
+    }
+
+    return *output;
+}
+
+template <typename T, size_t N>
+template <size_t K>
+std::vector<Dual<T, K>>
+MLP<T, N>::operator()(const std::vector<Dual<T, K>> &x) const {
+    std::vector<Dual<T, K>> output, buffer;
+    forward(x, output, buffer);
+    return output;
+}
+
+template <typename T, size_t N>
+template <size_t K>
+void MLP<T, N>::forward(const std::vector<Dual<T, K>> &x,
+                        std::vector<Dual<T, K>> &out,
+                        std::vector<Dual<T, K>> &buffer) const {
+    if (x.size() != m_num_neurons_in) {
+        throw std::invalid_argument("MLP input of the wrong size");
+    }
+    size_t width = 0;
+    for (size_t n : m_num_neurons_out) {
+        width = std::max(width, n);
+    }
+    out.resize(width);
+    buffer.resize(width);
+
+    // The first layer reads x, then every layer reads the buffer written by
+    // the previous one. They alternate so that the last one writes to out
+    const Dual<T, K> *input = x.data();
+    for (size_t i = 0; i < N; i++) {
+        Dual<T, K> *output = (N - 1 - i) % 2 == 0 ? out.data() : buffer.data();
+        m_layers[i].forward(input, output);
+        input = output;
+    }
+    out.resize(m_num_neurons_out[N - 1]);
+}
+
+template <typename T, size_t N>
+std::vector<T> MLP<T, N>::predict(const std::vector<T> &x) const {
+    return predict(std::vector<std::vector<T>>{x})[0];
+}
+
+template <typename T, size_t N>
+std::vector<std::vector<T>>
+MLP<T, N>::predict(const std::vector<std::vector<T>> &xs) const {
+    // The neurons read as many inputs as they have weights
+    for (auto &x : xs) {
+        if (x.size() != m_num_neurons_in) {
+            throw std::invalid_argument("MLP input of the wrong size");
+        }
+    }
+    std::vector<std::vector<T>> outputs = xs;
+    for (auto &layer : m_layers) {
+        outputs = layer.predict(outputs);
+    }
+    return outputs;
+}
+
+template <typename T, size_t N> Value_Vec<T> &MLP<T, N>::last_inputs() {
+    if (this->_drop_released_outputs()) {
+        throw std::logic_error(
+            "last_inputs after the end of the GraphScope of the forward pass");
+    }
+    // Every forward pass pushes the inputs and the N layers outputs
+    if (m_layers_output.size() < N + 1) {
+        throw std::out_of_range("last_inputs with no forward pass kept");
+    }
+    return *m_layers_output[m_layers_output.size() - (N + 1)];
 }
 
 template <typename T, size_t N>
@@ -247,3 +723,29 @@ std::vector<Value<T> *> MLP<T, N>::parameters() {
     }
     return params;
 }
+
+template <typename T, size_t N>
+std::vector<Value<T> *> MLP<T, N>::touched_parameters() {
+    std::vector<Value<T> *> params = m_layers[0].touched_parameters();
+    // Only the first layer gets sparse inputs
+    for (size_t i = 1; i < N; i++) {
+        auto layer_params = m_layers[i].parameters();
+        params.insert(params.end(), layer_params.begin(), layer_params.end());
+    }
+    return params;
+}
+
+template <typename T, size_t N> void MLP<T, N>::release_graph() {
+    Module<T>::release_graph();
+    for (auto &layer : m_layers) {
+        layer.release_graph();
+    }
+}
+
+template <typename T, size_t N> void MLP<T, N>::zero_touched_grad() {
+    m_layers[0].zero_touched_grad();
+    for (size_t i = 1; i < N; i++) {
+        m_layers[i].zero_grad();
+    }
+    Module<T>::release_graph();
+}
@@ -0,0 +1,114 @@
+//  optim.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "engine.hpp"
+#include <unordered_map>
+
+using namespace value_engine;
+
+// Stochastic gradient descent with L2 regularization applied as weight decay:
+// adding alpha * sum(p^2) to the loss is the same as adding 2 * alpha * p to
+// the gradient, so we never have to build the regularization graph
+template <typename T> class SGD {
+public:
+    SGD(std::vector<Value<T> *> parameters, T learning_rate,
+        T weight_decay = 0.0);
+
+    // p -= learning_rate * (p.grad + weight_decay * p)
+    void step();
+    // Sparse step: only the touched parameters (e.g. from
+    // MLP::touched_parameters) are updated. The others would only decay, so
+    // their decay is kept pending and applied in one go the next time they
+    // are touched or on flush(). As in the usual lazy sparse updates, a
+    // forward pass reads the weights before their pending decay, so the
+    // result only matches step() exactly without weight decay. When
+    // learning_rate * weight_decay >= 1 the decay factor is not positive and
+    // has no log, so the step decays every parameter eagerly instead
+    void step(const std::vector<Value<T> *> &touched);
+    // Apply the pending weight decay to every parameter, call it before
+    // reading the parameters after sparse steps
+    void flush();
+    void zero_grad();
+
+public:
+    T learning_rate;
+    T weight_decay;
+
+protected:
+    std::vector<Value<T> *> m_parameters;
+    // Sum of log(1 - learning_rate * weight_decay) over the sparse steps, and
+    // its value when every parameter was last updated (0 if never)
+    T m_log_decay;
+    std::unordered_map<Value<T> *, T> m_last_decay;
+};
+
+//  ================ Implementation SGD =================
+
+template <typename T>
+SGD<T>::SGD(std::vector<Value<T> *> parameters, T learning_rate,
+            T weight_decay)
+    : learning_rate(learning_rate), weight_decay(weight_decay),
+      m_parameters(std::move(parameters)), m_log_decay(0.0) {}
+
+template <typename T> void SGD<T>::step() {
+    flush();
+    for (Value<T> *p : m_parameters) {
+        p->data -= learning_rate * (p->grad + weight_decay * p->data);
+    }
+}
+
+template <typename T>
+void SGD<T>::step(const std::vector<Value<T> *> &touched) {
+    // Without decay there is nothing to keep pending
+    if (weight_decay == 0.0 && m_log_decay == 0.0) {
+        for (Value<T> *p : touched) {
+            p->data -= learning_rate * p->grad;
+        }
+        return;
+    }
+
+    // Every step p -= learning_rate * weight_decay * p multiplies p by
+    // (1 - learning_rate * weight_decay), so the steps p missed multiply it
+    // by e^(m_log_decay - last decay of p)
+    const T decay = 1.0 - learning_rate * weight_decay;
+    if (decay <= 0.0) {
+        flush();
+        for (Value<T> *p : m_parameters) {
+            p->data *= decay;
+        }
+        for (Value<T> *p : touched) {
+            p->data -= learning_rate * p->grad;
+        }
+        return;
+    }
+    for (Value<T> *p : touched) {
+        T &last = m_last_decay[p];
+        p->data *= std::exp(m_log_decay - last);
+        p->data = decay * p->data - learning_rate * p->grad;
+        last = m_log_decay + std::log(decay);
+    }
+    m_log_decay += std::log(decay);
+}
+
+template <typename T> void SGD<T>::flush() {
+    if (m_log_decay != 0.0) {
+        for (Value<T> *p : m_parameters) {
+            auto it = m_last_decay.find(p);
+            const T last = it == m_last_decay.end() ? T(0.0) : it->second;
+            p->data *= std::exp(m_log_decay - last);
+        }
+    }
+    m_log_decay = 0.0;
+    m_last_decay.clear();
+}
+
+template <typename T> void SGD<T>::zero_grad() {
+    for (Value<T> *p : m_parameters) {
+        p->grad = 0.0;
+    }
+}
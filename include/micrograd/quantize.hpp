@@ -0,0 +1,191 @@
+//  quantize.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "nn.hpp"
+#include <cstdint>
+
+// Post training int8 quantization of a trained MLP for inference only. The
+// weights of every neuron are stored as int8 with a scale of their own
+// (max |w| / 127), the activations entering a layer are quantized on the fly
+// with a single scale for the whole layer (max |a| / 127). Every dot product
+// is then int8 * int8 accumulated in int32 and rescaled once per neuron.
+// A weight takes 1 byte instead of a sizeof(T) data in a Value
+template <typename T, size_t N> class QuantizedMLP {
+public:
+    explicit QuantizedMLP(const MLP<T, N> &model);
+
+    // Integer path, thread safe like MLP::predict
+    std::vector<T> predict(const std::vector<T> &x) const;
+    // Same into out, q holds the quantized inputs of the current layer. Both
+    // keep their capacity, so reusing them across calls does not allocate
+    void predict(const std::vector<T> &x, std::vector<T> &out,
+                 std::vector<int8_t> &q) const;
+    std::vector<std::vector<T>>
+    predict(const std::vector<std::vector<T>> &xs) const;
+    // Float fallback: same int8 weights with T activations, for when the
+    // activations do not fit in 8 bits (e.g. a few very large inputs)
+    std::vector<T> predict_float(const std::vector<T> &x) const;
+
+    // Bytes taken by the weights, the scales and the biases
+    size_t size_bytes() const;
+
+protected:
+    struct QuantizedLayer {
+        size_t num_inputs;
+        size_t num_outputs;
+        activation act;
+        std::vector<int8_t> weights; // a row of num_inputs for every neuron
+        std::vector<float> scales;   // scale of every row
+        std::vector<float> bias;
+    };
+
+    // Symmetric quantization of n values with a single scale
+    static float _quantize(const T *x, size_t n, int8_t *q);
+    void _check_input(const std::vector<T> &x) const;
+
+protected:
+    std::array<QuantizedLayer, N> m_layers;
+    // Widest layer, inputs included, the size of the buffers of predict
+    size_t m_width = 0;
+};
+
+//  ================ Implementation QuantizedMLP =================
+
+template <typename T, size_t N>
+QuantizedMLP<T, N>::QuantizedMLP(const MLP<T, N> &model)
+    : m_width(model.num_inputs()) {
+    std::vector<T> row;
+    for (size_t l = 0; l < N; l++) {
+        const auto &neurons = model.m_layers[l].neurons();
+        auto &layer = m_layers[l];
+        layer.num_inputs = neurons[0].weights().size();
+        layer.num_outputs = neurons.size();
+        layer.act = model.m_layers[l].act();
+        layer.weights.resize(layer.num_inputs * layer.num_outputs);
+        m_width = std::max(m_width, layer.num_outputs);
+
+        for (size_t j = 0; j < neurons.size(); j++) {
+            row.clear();
+            for (auto &w : neurons[j].weights()) {
+                row.push_back(w.data);
+            }
+            layer.scales.push_back(_quantize(row.data(), row.size(),
+                                             &layer.weights[j * row.size()]));
+            layer.bias.push_back(float(neurons[j].bias().data));
+        }
+    }
+}
+
+template <typename T, size_t N>
+float QuantizedMLP<T, N>::_quantize(const T *x, size_t n, int8_t *q) {
+    T max = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        max = std::max(max, std::abs(x[i]));
+    }
+    // All zeros, any scale works
+    const float scale = max > 0.0 ? float(max / 127.0) : 1.0f;
+    for (size_t i = 0; i < n; i++) {
+        const float v = std::round(float(x[i]) / scale);
+        q[i] = int8_t(std::clamp(v, -127.0f, 127.0f));
+    }
+    return scale;
+}
+
+template <typename T, size_t N>
+void QuantizedMLP<T, N>::_check_input(const std::vector<T> &x) const {
+    // The first layer reads as many inputs as it has weights
+    if (x.size() != m_layers[0].num_inputs) {
+        throw std::invalid_argument("QuantizedMLP input of the wrong size");
+    }
+}
+
+template <typename T, size_t N>
+std::vector<T> QuantizedMLP<T, N>::predict(const std::vector<T> &x) const {
+    std::vector<T> out;
+    std::vector<int8_t> q;
+    predict(x, out, q);
+    return out;
+}
+
+template <typename T, size_t N>
+void QuantizedMLP<T, N>::predict(const std::vector<T> &x, std::vector<T> &out,
+                                 std::vector<int8_t> &q) const {
+    _check_input(x);
+    out.resize(m_width);
+    q.resize(m_width);
+
+    // A layer only reads its quantized inputs, so it can write its outputs
+    // over the activations it came from
+    const T *input = x.data();
+    for (auto &layer : m_layers) {
+        const float input_scale = _quantize(input, layer.num_inputs, q.data());
+
+        with_activation(layer.act, [&](auto act) {
+            for (size_t j = 0; j < layer.num_outputs; j++) {
+                const int8_t *w = &layer.weights[j * layer.num_inputs];
+                int32_t acc = 0;
+                for (size_t i = 0; i < layer.num_inputs; i++) {
+                    acc += int32_t(w[i]) * int32_t(q[i]);
+                }
+                T y = float(acc) * layer.scales[j] * input_scale +
+                      layer.bias[j];
+                out[j] = act.apply(y);
+            }
+        });
+        input = out.data();
+    }
+    out.resize(m_layers[N - 1].num_outputs);
+}
+
+template <typename T, size_t N>
+std::vector<std::vector<T>>
+QuantizedMLP<T, N>::predict(const std::vector<std::vector<T>> &xs) const {
+    std::vector<std::vector<T>> outputs(xs.size());
+    std::vector<T> out;
+    std::vector<int8_t> q;
+    for (size_t i = 0; i < xs.size(); i++) {
+        predict(xs[i], out, q);
+        outputs[i] = out;
+    }
+    return outputs;
+}
+
+template <typename T, size_t N>
+std::vector<T>
+QuantizedMLP<T, N>::predict_float(const std::vector<T> &x) const {
+    _check_input(x);
+    std::vector<T> activations = x;
+    std::vector<T> outputs;
+
+    for (auto &layer : m_layers) {
+        outputs.resize(layer.num_outputs);
+        with_activation(layer.act, [&](auto act) {
+            for (size_t j = 0; j < layer.num_outputs; j++) {
+                const int8_t *w = &layer.weights[j * layer.num_inputs];
+                T acc = 0.0;
+                for (size_t i = 0; i < layer.num_inputs; i++) {
+                    acc += T(w[i]) * activations[i];
+                }
+                T out = acc * layer.scales[j] + layer.bias[j];
+                outputs[j] = act.apply(out);
+            }
+        });
+        std::swap(activations, outputs);
+    }
+    return activations;
+}
+
+template <typename T, size_t N> size_t QuantizedMLP<T, N>::size_bytes() const {
+    size_t bytes = 0;
+    for (auto &layer : m_layers) {
+        bytes += layer.weights.size() * sizeof(int8_t) +
+                 layer.scales.size() * sizeof(float) +
+                 layer.bias.size() * sizeof(float);
+    }
+    return bytes;
+}
@@ -0,0 +1,101 @@
+//  random.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Initialization of the weights
+enum init_type : char {
+    UNIFORM = 'u',  // uniform in [-1, 1]
+    XAVIER = 'x',   // uniform in +- sqrt(6 / (fan_in + fan_out))
+    HE = 'h'        // uniform in +- sqrt(6 / fan_in)
+};
+
+// Counter based random generator: the n-th number of a stream is a pure
+// function of (seed, stream, n), so a model built from the same seed is always
+// the same and a whole buffer can be filled in any order (or in parallel)
+class Random {
+public:
+    explicit Random(uint64_t seed = 1337, uint64_t stream = 0)
+        : m_key(_mix(seed) ^ _mix(stream + 0x632be59bd9b4e019)),
+          m_seed(seed), m_counter(0) {}
+
+    // Generator of the default seed on a stream no other call returned, for
+    // the modules built without one: two of them never get the same weights.
+    // The streams follow the order of the calls, so a program stays the same
+    // from run to run
+    static Random unique() {
+        static std::atomic<uint64_t> streams(0);
+        return Random(1337, ++streams);
+    }
+
+    // Independent generator for a sub part of the model
+    Random split(uint64_t stream) const {
+        return Random(m_seed, _mix(m_key + stream));
+    }
+
+    // Random bits at a given position of the stream
+    uint64_t at(uint64_t counter) const {
+        return _mix(m_key + counter * 0x9e3779b97f4a7c15);
+    }
+
+    uint64_t next() { return at(m_counter++); }
+
+    template <typename T> T uniform(T range_from, T range_to) {
+        return _uniform(next(), range_from, range_to);
+    }
+
+    // Fill n values in bulk, every value only depends on its position
+    template <typename T>
+    void fill_uniform(T *out, size_t n, T range_from, T range_to) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = _uniform(at(m_counter + i), range_from, range_to);
+        }
+        m_counter += n;
+    }
+
+    // Fill the n weights of a layer with the given initialization
+    template <typename T>
+    void fill(T *out, size_t n, size_t fan_in, size_t fan_out,
+              init_type init = UNIFORM) {
+        T limit = 1.0;
+        switch (init) {
+        case XAVIER:
+            limit = std::sqrt(6.0 / (fan_in + fan_out));
+            break;
+        case HE:
+            limit = std::sqrt(6.0 / fan_in);
+            break;
+        default:
+            break;
+        }
+        fill_uniform(out, n, -limit, limit);
+    }
+
+protected:
+    // splitmix64 finalizer
+    static uint64_t _mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+        return x ^ (x >> 31);
+    }
+
+    template <typename T>
+    static T _uniform(uint64_t bits, T range_from, T range_to) {
+        // 53 random bits to a double in [0, 1)
+        const double u = (bits >> 11) * 0x1.0p-53;
+        return range_from + (range_to - range_from) * u;
+    }
+
+protected:
+    uint64_t m_key;
+    uint64_t m_seed;
+    uint64_t m_counter;
+};
@@ -0,0 +1,147 @@
+//  serve.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "nn.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// Serves a trained model to many threads: single sample requests are queued
+// and a pool of workers coalesces them into micro batches of at most
+// max_batch samples. A worker waits at most max_delay for a batch to fill up,
+// which bounds the latency added by the batching. The model is only read
+// through MLP::predict and must not be trained while the server is running
+template <typename T, size_t N> class InferenceServer {
+public:
+    InferenceServer(const MLP<T, N> &model, size_t num_workers,
+                    size_t max_batch = 32,
+                    std::chrono::microseconds max_delay =
+                        std::chrono::microseconds(100));
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer &) = delete;
+    InferenceServer &operator=(const InferenceServer &) = delete;
+
+    // Queue a request, the future holds the outputs of the model. A request
+    // of the wrong size is not queued and its future throws
+    // std::invalid_argument
+    std::future<std::vector<T>> submit(std::vector<T> x);
+    // Queue a request and wait for it
+    std::vector<T> predict(std::vector<T> x) {
+        return submit(std::move(x)).get();
+    }
+
+protected:
+    struct Request {
+        std::vector<T> input;
+        std::promise<std::vector<T>> output;
+    };
+
+    // Run by every worker of the pool
+    void _worker();
+
+protected:
+    const MLP<T, N> &m_model;
+    const size_t m_max_batch;
+    const std::chrono::microseconds m_max_delay;
+
+    std::deque<Request> m_queue;
+    bool m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_not_empty;
+
+    std::vector<std::thread> m_workers;
+};
+
+//  ================ Implementation InferenceServer =================
+
+template <typename T, size_t N>
+InferenceServer<T, N>::InferenceServer(const MLP<T, N> &model,
+                                       size_t num_workers, size_t max_batch,
+                                       std::chrono::microseconds max_delay)
+    : m_model(model), m_max_batch(std::max(max_batch, size_t(1))),
+      m_max_delay(max_delay), m_stop(false) {
+    for (size_t i = 0; i < std::max(num_workers, size_t(1)); i++) {
+        m_workers.emplace_back(&InferenceServer<T, N>::_worker, this);
+    }
+}
+
+template <typename T, size_t N> InferenceServer<T, N>::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_not_empty.notify_all();
+    for (auto &worker : m_workers) {
+        worker.join();
+    }
+}
+
+template <typename T, size_t N>
+std::future<std::vector<T>> InferenceServer<T, N>::submit(std::vector<T> x) {
+    // Checked here so that a worker never reads past a short input
+    if (x.size() != m_model.num_inputs()) {
+        std::promise<std::vector<T>> failed;
+        failed.set_exception(std::make_exception_ptr(
+            std::invalid_argument("request of the wrong size")));
+        return failed.get_future();
+    }
+
+    std::future<std::vector<T>> output;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(Request{std::move(x), {}});
+        output = m_queue.back().output.get_future();
+    }
+    m_not_empty.notify_one();
+    return output;
+}
+
+template <typename T, size_t N> void InferenceServer<T, N>::_worker() {
+    std::vector<Request> requests;
+    std::vector<std::vector<T>> batch;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock,
+                             [this] { return !m_queue.empty() || m_stop; });
+            // Pending requests are still served when stopping
+            if (m_queue.empty()) {
+                return;
+            }
+
+            // Give the batch some time to fill up, bounded by max_delay from
+            // the moment the first request is seen
+            const auto deadline =
+                std::chrono::steady_clock::now() + m_max_delay;
+            m_not_empty.wait_until(lock, deadline, [this] {
+                return m_queue.size() >= m_max_batch || m_stop;
+            });
+
+            while (!m_queue.empty() && requests.size() < m_max_batch) {
+                requests.push_back(std::move(m_queue.front()));
+                m_queue.pop_front();
+            }
+        }
+
+        // Other workers can take the rest of the queue meanwhile
+        batch.clear();
+        for (auto &request : requests) {
+            batch.push_back(std::move(request.input));
+        }
+        auto outputs = m_model.predict(batch);
+        for (size_t i = 0; i < requests.size(); i++) {
+            requests[i].output.set_value(std::move(outputs[i]));
+        }
+        requests.clear();
+    }
+}
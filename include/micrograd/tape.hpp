@@ -0,0 +1,347 @@
+//  tape.hpp
+//  Micrograd_C++
+//
+//  Created by Jacopo Zacchigna on 2023-02-19
+//  Copyright © 2023 Jacopo Zacchigna. All rights reserved.
+
+#pragma once
+
+#include "dual.hpp"
+#include "engine.hpp"
+
+namespace value_engine {
+
+// Records the graph of one or more outputs once (a single topological sort)
+// so that it can be swept backward many times with different seeds.
+// The same recorded graph can also be re-evaluated incrementally: set() marks
+// the changed leaves dirty and forward() recomputes only the values downstream
+// of them, in time proportional to that cone instead of the whole graph
+template <typename T> class Tape {
+ public:
+    explicit Tape(const std::vector<Value<T> *> &outputs);
+    explicit Tape(Value_Vec<T> &outputs);
+
+    // Reverse sweep seeded with v: the gradients are v^T J
+    // The gradients of every value on the tape are reset before the sweep.
+    // It always sweeps the whole tape, even after an incremental forward():
+    // the outputs are in the cone of any change, so the adjoint of every
+    // value upstream of them changes too.
+    // Throws std::invalid_argument unless there is a seed for every output
+    void backward(const std::vector<T> &seed);
+    // Reverse sweep seeded with the i-th row of the identity, throws
+    // std::out_of_range for an index past the outputs
+    void backward(size_t output);
+
+    // Jacobian (outputs x inputs) of the outputs with respect to the inputs.
+    // A single reverse sweep carries the adjoints of all the outputs at once
+    // (size() x outputs values), the gradients are zero afterwards
+    std::vector<std::vector<T>>
+    jacobian(const std::vector<Value<T> *> &inputs);
+    std::vector<std::vector<T>> jacobian(Value_Vec<T> &inputs);
+
+    void zero_grad();
+
+    // Change the data of a leaf of the tape, nothing is recomputed until
+    // forward() is called. A value which is not on the tape is left untouched
+    // and std::out_of_range is thrown, std::invalid_argument for a value
+    // computed by an op since forward() would overwrite it
+    void set(Value<T> &leaf, T data);
+    // Recompute the values downstream of the leaves changed since the last
+    // call, returns how many values were recomputed
+    size_t forward();
+
+    size_t size() const { return m_sorted_values.size(); }
+
+ protected:
+    // Iterative topological sort of the outputs
+    void _topo_sort();
+    // Position of every value and the values using it, built on the first
+    // set() or jacobian() since plain backward sweeps do not need them
+    void _index_consumers();
+    // Distinct children of v, m_prev followed by m_operands
+    void _children(Value<T> *v, std::vector<Value<T> *> &children);
+
+ protected:
+    std::vector<Value<T> *> m_outputs;
+    std::vector<Value<T> *> m_sorted_values;
+
+    std::unordered_map<Value<T> *, size_t> m_index;
+    std::vector<std::vector<size_t>> m_consumers;
+    // Dirty leaves and the marks of the values already in the cone
+    std::vector<size_t> m_dirty;
+    std::vector<bool> m_marked;
+    // Marks of the children already found by _children, apart from m_marked
+    // which keeps the dirty leaves until forward()
+    std::vector<bool> m_is_child;
+};
+
+// ==================== Implementation =====================
+
+template <typename T>
+Tape<T>::Tape(const std::vector<Value<T> *> &outputs) : m_outputs(outputs) {
+    _topo_sort();
+}
+
+template <typename T>
+Tape<T>::Tape(Value_Vec<T> &outputs) : m_outputs(_operands(outputs)) {
+    _topo_sort();
+}
+
+template <typename T> void Tape<T>::_topo_sort() {
+    std::unordered_set<Value<T> *> visited;
+    // Stack of values with the index of the next child to visit, the
+    // children are m_prev followed by m_operands
+    std::vector<std::pair<Value<T> *, size_t>> stack;
+
+    for (auto *output : m_outputs) {
+        if (visited.count(output) != 0) {
+            continue;
+        }
+        visited.insert(output);
+        stack.emplace_back(output, 0);
+
+        while (!stack.empty()) {
+            auto &[v, next] = stack.back();
+            const size_t num_children = 2 + v->m_operands.size();
+
+            // Find the next child which still has to be visited
+            Value<T> *child = nullptr;
+            while (next < num_children && child == nullptr) {
+                Value<T> *candidate =
+                    next < 2 ? v->m_prev[next] : v->m_operands[next - 2];
+                next++;
+                if (candidate != nullptr && visited.count(candidate) == 0) {
+                    child = candidate;
+                }
+            }
+
+            if (child != nullptr) {
+                visited.insert(child);
+                stack.emplace_back(child, 0);
+            } else {
+                // All the children are done
+                m_sorted_values.push_back(v);
+                stack.pop_back();
+            }
+        }
+    }
+}
+
+template <typename T> void Tape<T>::_index_consumers() {
+    m_index.reserve(m_sorted_values.size());
+    for (size_t i = 0; i < m_sorted_values.size(); i++) {
+        m_index[m_sorted_values[i]] = i;
+    }
+
+    m_consumers.assign(m_sorted_values.size(), {});
+    for (size_t i = 0; i < m_sorted_values.size(); i++) {
+        Value<T> *v = m_sorted_values[i];
+        for (auto *child : v->m_prev) {
+            if (child != nullptr) {
+                m_consumers[m_index[child]].push_back(i);
+            }
+        }
+        for (auto *child : v->m_operands) {
+            m_consumers[m_index[child]].push_back(i);
+        }
+    }
+    m_marked.assign(m_sorted_values.size(), false);
+    m_is_child.assign(m_sorted_values.size(), false);
+}
+
+template <typename T>
+void Tape<T>::_children(Value<T> *v, std::vector<Value<T> *> &children) {
+    // The same child can appear more than once (e.g. a * a or the max)
+    children.clear();
+    auto add = [&](Value<T> *child) {
+        if (child != nullptr && !m_is_child[m_index[child]]) {
+            m_is_child[m_index[child]] = true;
+            children.push_back(child);
+        }
+    };
+    for (auto *child : v->m_prev) {
+        add(child);
+    }
+    for (auto *child : v->m_operands) {
+        add(child);
+    }
+    for (auto *child : children) {
+        m_is_child[m_index[child]] = false;
+    }
+}
+
+template <typename T> void Tape<T>::set(Value<T> &leaf, T data) {
+    if (m_consumers.empty()) {
+        _index_consumers();
+    }
+    // Throws std::out_of_range for a value not on the tape, before changing it
+    const size_t i = m_index.at(&leaf);
+    if (leaf.m_op != ' ') {
+        throw std::invalid_argument("set of a value which is not a leaf");
+    }
+    leaf.data = data;
+    if (!m_marked[i]) {
+        m_marked[i] = true;
+        m_dirty.push_back(i);
+    }
+}
+
+template <typename T> size_t Tape<T>::forward() {
+    // Every value reachable from the dirty leaves through the consumers
+    std::vector<size_t> cone;
+    std::vector<size_t> stack = m_dirty;
+    while (!stack.empty()) {
+        const size_t i = stack.back();
+        stack.pop_back();
+        for (size_t consumer : m_consumers[i]) {
+            if (!m_marked[consumer]) {
+                m_marked[consumer] = true;
+                cone.push_back(consumer);
+                stack.push_back(consumer);
+            }
+        }
+    }
+
+    // The positions on the tape are a topological order, so sorting the cone
+    // recomputes every value after its children
+    std::sort(cone.begin(), cone.end());
+    for (size_t i : cone) {
+        m_sorted_values[i]->_forward_single();
+        m_marked[i] = false;
+    }
+
+    for (size_t i : m_dirty) {
+        m_marked[i] = false;
+    }
+    m_dirty.clear();
+    return cone.size();
+}
+
+template <typename T> void Tape<T>::zero_grad() {
+    for (auto *v : m_sorted_values) {
+        v->grad = 0.0;
+    }
+}
+
+template <typename T> void Tape<T>::backward(const std::vector<T> &seed) {
+    if (seed.size() != m_outputs.size()) {
+        throw std::invalid_argument(
+            "backward seed with a different size than the outputs");
+    }
+    zero_grad();
+    for (size_t i = 0; i < m_outputs.size(); i++) {
+        m_outputs[i]->grad += seed[i];
+    }
+
+    // Call backward in topological order applying the chain rule
+    for (auto it = m_sorted_values.rbegin(); it != m_sorted_values.rend();
+         ++it) {
+        (*it)->_backward_single();
+    }
+}
+
+template <typename T> void Tape<T>::backward(size_t output) {
+    if (output >= m_outputs.size()) {
+        throw std::out_of_range("backward of an output not on the tape");
+    }
+    std::vector<T> seed(m_outputs.size(), T(0.0));
+    seed[output] = 1.0;
+    backward(seed);
+}
+
+template <typename T>
+std::vector<std::vector<T>>
+Tape<T>::jacobian(const std::vector<Value<T> *> &inputs) {
+    if (m_consumers.empty()) {
+        _index_consumers();
+    }
+
+    // Row of adjoints of every value: the derivatives of all the outputs
+    // with respect to it, seeded with the identity
+    const size_t rows = m_outputs.size();
+    std::vector<T> adjoints(m_sorted_values.size() * rows, T(0.0));
+    for (size_t i = 0; i < rows; i++) {
+        adjoints[m_index[m_outputs[i]] * rows + i] += 1.0;
+    }
+
+    std::vector<Value<T> *> children;
+    for (size_t n = m_sorted_values.size(); n-- > 0;) {
+        Value<T> *v = m_sorted_values[n];
+        _children(v, children);
+
+        // The kernels are linear in the gradient of v: running the one of v
+        // with a unit gradient on children with no gradient gives the local
+        // derivatives, which then scale the whole row of v
+        for (auto *child : children) {
+            child->grad = 0.0;
+        }
+        v->grad = 1.0;
+        v->_backward_single();
+
+        const T *adjoint = &adjoints[n * rows];
+        for (auto *child : children) {
+            T *child_adjoint = &adjoints[m_index[child] * rows];
+            for (size_t i = 0; i < rows; i++) {
+                child_adjoint[i] += child->grad * adjoint[i];
+            }
+            child->grad = 0.0;
+        }
+    }
+    zero_grad();
+
+    // The outputs do not depend on the inputs which are not on the tape
+    std::vector<std::vector<T>> jacobian(rows,
+                                         std::vector<T>(inputs.size(), T(0.0)));
+    for (size_t j = 0; j < inputs.size(); j++) {
+        auto it = m_index.find(inputs[j]);
+        if (it == m_index.end()) {
+            continue;
+        }
+        for (size_t i = 0; i < rows; i++) {
+            jacobian[i][j] = adjoints[it->second * rows + i];
+        }
+    }
+    return jacobian;
+}
+
+template <typename T>
+std::vector<std::vector<T>> Tape<T>::jacobian(Value_Vec<T> &inputs) {
+    return jacobian(_operands(inputs));
+}
+
+// ==================== Hessian vector products =====================
+// Forward over reverse: the values carry K tangents (Value<Dual<T, K>>) and
+// the reverse sweep differentiates the gradient along them, so the tangents
+// of the gradients are the K products H v_k from a single backward pass
+
+// Seed the tangents of the leaves with the K directions, call it before
+// building the graph since the forward pass propagates them
+template <typename T, size_t K>
+void seed_tangents(const std::vector<Value<Dual<T, K>> *> &leaves,
+                   const std::array<std::vector<T>, K> &directions) {
+    for (size_t i = 0; i < leaves.size(); i++) {
+        for (size_t k = 0; k < K; k++) {
+            leaves[i]->data.tangent[k] = directions[k][i];
+        }
+    }
+}
+
+// Reverse sweep of the scalar root, returns the K Hessian vector products
+// with respect to the leaves seeded with seed_tangents
+template <typename T, size_t K>
+std::array<std::vector<T>, K>
+hessian_vector_product(Value<Dual<T, K>> &root,
+                       const std::vector<Value<Dual<T, K>> *> &leaves) {
+    Tape<Dual<T, K>> tape({&root});
+    tape.backward(0);
+
+    std::array<std::vector<T>, K> products;
+    for (size_t k = 0; k < K; k++) {
+        products[k].reserve(leaves.size());
+        for (auto *leaf : leaves) {
+            products[k].push_back(leaf->grad.tangent[k]);
+        }
+    }
+    return products;
+}
+}  // namespace value_engine